@@ -21,6 +21,7 @@
 #include "z_zone.h"
 
 #include <stdio.h>
+#include <sys/mman.h>
 
 typedef struct {
     wad_file_t wad;
@@ -43,10 +44,20 @@ static wad_file_t* W_StdC_OpenFile(char* path) {
 
     result = Z_Malloc(sizeof(stdc_wad_file_t), PU_STATIC, 0);
     result->wad.file_class = &stdc_wad_file;
-    result->wad.mapped = NULL;
     result->wad.length = M_FileLength(fstream);
     result->fstream = fstream;
 
+    // Map the file so that lumps are read straight from the page cache.
+    // Some code paths write to cached lumps: the mapping is private, pages
+    // being copied on write.
+
+    result->wad.mapped = mmap(NULL, result->wad.length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE, fstream->fd, 0);
+
+    if (result->wad.mapped == MAP_FAILED) {
+        result->wad.mapped = NULL;
+    }
+
     return &result->wad;
 }
 
@@ -55,6 +66,10 @@ static void W_StdC_CloseFile(wad_file_t* wad) {
 
     stdc_wad = (stdc_wad_file_t*) wad;
 
+    if (wad->mapped != NULL) {
+        munmap(wad->mapped, wad->length);
+    }
+
     fclose(stdc_wad->fstream);
     Z_Free(stdc_wad);
 }
@@ -6,5 +6,6 @@
 
 void init_fpu();
 void fpu_switch(process_t* prev, const process_t* next);
+void fpu_save_state(process_t* process);
 void fpu_kernel_enter();
 void fpu_kernel_exit();
\ No newline at end of file
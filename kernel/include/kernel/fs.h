@@ -32,8 +32,17 @@ typedef struct folder_inode_t {
     bool dirty;
     list_t subfolders;
     list_t subfiles;
+    uint32_t version; // Changes whenever entries are added or removed
 } folder_inode_t;
 
+/* Position of a reader in a directory, between calls to `fs_readdir`.
+ */
+typedef struct dir_cursor_t {
+    list_t* node; // Next entry, in `subfolders` or `subfiles`
+    uint32_t index; // Index of the next entry
+    uint32_t version; // Version of the directory `node` is valid for
+} dir_cursor_t;
+
 typedef struct fs_t {
     folder_inode_t* root;
     uint32_t uid;
@@ -47,6 +56,12 @@ typedef struct fs_t {
     inode_t* (*get_fs_inode)(struct fs_t*, uint32_t);
     int32_t (*close)(fs_t*, uint32_t);
     int32_t (*stat)(fs_t*, uint32_t, stat_t*);
+    /* Writes back cached metadata, may be NULL */
+    int32_t (*sync)(fs_t*);
+    /* Writes at an offset and resizes files, may be NULL for append-only
+     * filesystems */
+    uint32_t (*write_at)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
+    int32_t (*truncate)(struct fs_t*, uint32_t, uint32_t);
 } fs_t;
 
 typedef inode_t* (*fs_get_fs_inode_t)(struct fs_t*, uint32_t);
@@ -58,16 +73,22 @@ typedef int32_t (*fs_rename_t)(struct fs_t*, uint32_t, uint32_t, uint32_t);
 typedef uint32_t (*fs_create_t)(struct fs_t*, const char*, uint32_t, uint32_t);
 typedef int32_t (*fs_close_t)(struct fs_t*, uint32_t);
 typedef int32_t (*fs_stat_t)(struct fs_t*, uint32_t, stat_t*);
+typedef int32_t (*fs_sync_t)(struct fs_t*);
+typedef uint32_t (*fs_write_at_t)(struct fs_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
+typedef int32_t (*fs_truncate_t)(struct fs_t*, uint32_t, uint32_t);
 
 void init_fs(fs_t* fs);
 void fs_mount(const char* mount_point, fs_t* fs);
-char* fs_normalize_path(const char* p);
+bool fs_normalize_path(const char* p, char* buf);
+const char* fs_path_next(const char* p, uint32_t* len);
 inode_t* fs_open(const char* path, uint32_t mode);
 uint32_t fs_mkdir(const char* path, uint32_t mode);
 int32_t fs_unlink(const char* path);
 int32_t fs_rename(const char* oldp, const char* newp);
 int32_t fs_close(inode_t* in);
 uint32_t fs_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size);
-uint32_t fs_write(inode_t* in, uint8_t* buf, uint32_t size);
-uint32_t fs_readdir(inode_t* in, uint32_t offset, sos_directory_entry_t* d_ent, uint32_t size);
-int32_t fs_stat(const char* path, stat_t* buf);
\ No newline at end of file
+uint32_t fs_write(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size);
+int32_t fs_truncate(inode_t* in, uint32_t size);
+uint32_t fs_readdir(inode_t* in, dir_cursor_t* cursor, sos_directory_entry_t* d_ent, uint32_t size);
+int32_t fs_stat(const char* path, stat_t* buf);
+void fs_sync();
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <kernel/fs.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of executable images kept cached while no process runs them.
+ */
+#define IMAGE_CACHE_MAX_IDLE 16
+
+/* A loaded ELF executable, shared by every process running it. Its pages hold
+ * the initial content of the executable's file-backed memory; the pages in
+ * between that are only part of `.bss` aren't stored.
+ */
+typedef struct image_t {
+    uint32_t fs_uid;
+    uint32_t inode_no;
+    uint32_t users; // Number of processes running this image
+    bool stale; // Whether the file changed since it was loaded
+    uintptr_t entry;
+    uintptr_t start; // First mapped page
+    uintptr_t end; // End of the last mapped page
+    uint32_t* pages; // Frame and flags of each page, zero if not stored
+} image_t;
+
+image_t* image_get(inode_t* in);
+image_t* image_create(inode_t* in, const uint8_t* data, uint32_t size);
+void image_map(image_t* image);
+void image_release(image_t* image);
+void image_invalidate(inode_t* in);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <kernel/fs.h>
+
+#include <list.h>
+#include <stdint.h>
+
+#define PAGE_CACHE_BUCKETS 512
+
+/* Number of file pages kept cached, the least recently used ones being
+ * evicted past it. Pages mapped by processes aren't evicted.
+ */
+#define PAGE_CACHE_MAX_PAGES 2048
+
+/* Bounds of the readahead window, in pages. The window starts small when a
+ * file is first read sequentially, and doubles with each sequential read.
+ */
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+/* A page of the content of a file. Bytes past the end of the file are zero.
+ */
+typedef struct cached_page_t {
+    uint32_t fs_uid;
+    uint32_t inode_no;
+    uint32_t index; // Offset in the file, in pages
+    uintptr_t frame;
+    struct cached_page_t* next; // In the same bucket
+    list_t lru;
+} cached_page_t;
+
+/* Sequential access state of an open file.
+ */
+typedef struct readahead_t {
+    uint32_t next; // Offset at which a sequential read would start
+    uint32_t window; // Pages to read ahead, zero for random accesses
+    uint32_t ahead; // First page not read ahead yet
+} readahead_t;
+
+void init_page_cache();
+uint32_t page_cache_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size, readahead_t* ra);
+uintptr_t page_cache_get_frame(inode_t* in, uint32_t index);
+void page_cache_write(inode_t* in, uint32_t offset, const uint8_t* buf, uint32_t size);
+void page_cache_truncate(inode_t* in, uint32_t size);
+void page_cache_invalidate(inode_t* in);
+uint32_t page_cache_hits();
+uint32_t page_cache_misses();
@@ -17,12 +17,17 @@ page_t* paging_get_page(uintptr_t virt, bool create, uint32_t flags);
 void paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags);
 void paging_unmap_page(uintptr_t virt);
 void paging_map_pages(uintptr_t phys, uintptr_t virt, uint32_t num, uint32_t flags);
+void paging_map_large_page(uintptr_t virt, uintptr_t phys, uint32_t flags);
+void* paging_map_kernel(uintptr_t phys, uint32_t size, uint32_t flags);
 void paging_unmap_pages(uintptr_t virt, uint32_t num);
 void paging_switch_directory(uintptr_t dir_phys);
 void paging_invalidate_cache();
 void paging_invalidate_page(uintptr_t virt);
 void paging_fault_handler(registers_t* regs);
 void* paging_alloc_pages(uint32_t virt, uint32_t num);
+void* paging_map_temp(uint32_t slot, uintptr_t phys);
+uintptr_t paging_fork_directory();
+void paging_free_user_space();
 void paging_free_pages(uintptr_t virt, uint32_t num);
 uintptr_t paging_virt_to_phys(uintptr_t virt);
 
@@ -42,10 +47,27 @@ uintptr_t paging_virt_to_phys(uintptr_t virt);
 #define KERNEL_HEAP_BEGIN KERNEL_END_MAP
 #define KERNEL_HEAP_SIZE 0x1E00000
 
+/* Physical memory the kernel accesses directly, e.g. the framebuffer, is mapped
+ * after the heap by `paging_map_kernel`. Small mappings share the last page
+ * table of the heap, larger ones get directory entries of their own.
+ * Note: page directories only copy kernel entries when created, so large
+ * mappings must be made before processes are.
+ */
+#define KERNEL_MAP_BEGIN (KERNEL_HEAP_BEGIN + KERNEL_HEAP_SIZE)
+#define KERNEL_MAP_LARGE_BEGIN 0xC2400000
+#define KERNEL_MAP_END 0xFFC00000
+
+#define LARGE_PAGE_SIZE 0x400000
+
 #define PAGE_PRESENT 1
 #define PAGE_RW      2
 #define PAGE_USER    4
+#define PAGE_WRITE_THROUGH 8 // Write-combining, see `pat.c`
+#define PAGE_CACHE_DISABLE 16
 #define PAGE_LARGE   128
+#define PAGE_GLOBAL  256 // Kept in the TLB across address spaces
+#define PAGE_COW     0x200 // Available to us: read-only until copied on write
+#define PAGE_SHARED  0x400 // Available to us: stays writable across forks
 
 #define PAGE_FRAME   0xFFFFF000
 #define PAGE_FLAGS   0x00000FFF
\ No newline at end of file
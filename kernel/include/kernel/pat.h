@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+void init_pat();
+uint32_t pat_write_combining(uintptr_t phys, uint32_t size);
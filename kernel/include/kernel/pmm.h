@@ -2,6 +2,7 @@
 
 #include <kernel/multiboot2.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void init_pmm(mb2_t* boot);
@@ -14,8 +15,15 @@ uintptr_t pmm_alloc_aligned_large_page();
 uintptr_t pmm_alloc_pages(uint32_t num);
 void pmm_free_page(uintptr_t addr);
 void pmm_free_pages(uintptr_t addr, uint32_t num);
+void pmm_ref_page(uintptr_t addr);
+bool pmm_page_shared(uintptr_t addr);
 uintptr_t pmm_get_kernel_end();
 
 extern uint32_t* mem_map;
 
-#define PMM_BLOCK_SIZE 4096
\ No newline at end of file
+#define PMM_BLOCK_SIZE 4096
+
+/* Physical memory above this limit is left unused.
+ */
+#define PMM_MAX_MEMORY 0x20000000
+#define PMM_MAX_BLOCKS (PMM_MAX_MEMORY / PMM_BLOCK_SIZE)
@@ -1,12 +1,27 @@
 #pragma once
 
 #include <kernel/fs.h>
+#include <kernel/image.h>
+#include <kernel/page_cache.h>
+#include <kernel/isr.h>
 
 #include <list.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PROC_STACK_PAGES 4
+/* Process stacks grow down from `PROC_STACK_TOP`, one page at a time as they
+ * are touched, up to `PROC_STACK_MAX_PAGES`. The guard region below can't be
+ * mapped: faults in it are reported as stack overflows.
+ */
+#define PROC_STACK_TOP 0xC0000000
+#define PROC_STACK_MAX_PAGES 256
+#define PROC_STACK_GUARD_PAGES 16
+#define PROC_STACK_LIMIT (PROC_STACK_TOP - 0x1000*PROC_STACK_MAX_PAGES)
+#define PROC_STACK_GUARD (PROC_STACK_LIMIT - 0x1000*PROC_STACK_GUARD_PAGES)
+/* File mappings and memory shared with the kernel are placed right below the
+ * stack guard, growing down towards the heap.
+ */
+#define PROC_MMAP_TOP PROC_STACK_GUARD
 #define PROC_KERNEL_STACK_PAGES 1
 #define PROC_MAX_FD 1024
 
@@ -16,8 +31,9 @@ typedef struct {
     uint32_t mode;
     uint32_t offset;
     uint32_t size;
-    uint32_t index; // If it's a directory, where we're at
+    dir_cursor_t cursor; // If it's a directory, where we're at
     uint32_t refcount;
+    readahead_t readahead; // If it's a file, how it's being read
 } ft_entry_t;
 
 // Add new members to the end to avoid messing with the offsets
@@ -38,6 +54,10 @@ typedef struct _proc_t {
     uint8_t fpu_registers[512];
     list_t filetable;
     char* cwd;
+    uint32_t minor_faults; // Pages mapped on first touch
+    uintptr_t entry; // Address of the first instruction to run
+    image_t* image; // Cached executable, if any
+    uintptr_t mmap_bottom; // Start of the lowest mapping, see `PROC_MMAP_TOP`
 } process_t;
 
 /* This structure defines the interface of schedulers in SnowflakeOS.
@@ -68,17 +88,26 @@ void proc_exit();
 void proc_enter_usermode();
 void proc_switch_process(process_t* next);
 uint32_t proc_get_current_pid();
+uint32_t proc_get_minor_faults();
 char* proc_get_cwd();
+const char* proc_peek_cwd();
 void proc_add_fd(ft_entry_t* entry);
 
 void proc_sleep(uint32_t ms);
 void* proc_sbrk(intptr_t size);
+bool proc_map_lazy_page(uintptr_t addr);
 int32_t proc_exec(const char* path, char** argv);
+uint32_t proc_fork(registers_t* regs);
+int32_t proc_execve(const char* path, char** argv, registers_t* regs);
 uint32_t proc_open(const char* path, uint32_t flags);
 void proc_close(uint32_t fd);
 uint32_t proc_read(uint32_t fd, uint8_t* buf, uint32_t size);
 int32_t proc_readdir(uint32_t fd, sos_directory_entry_t* dent);
+int32_t proc_getdents(uint32_t fd, uint8_t* buf, uint32_t size);
 uint32_t proc_write(uint32_t fd, uint8_t* buf, uint32_t size);
 int32_t proc_fseek(uint32_t fd, int32_t offset, uint32_t whence);
 int32_t proc_ftell(uint32_t fd);
-int32_t proc_chdir(const char* path);
\ No newline at end of file
+int32_t proc_chdir(const char* path);
+void* proc_mmap(uint32_t fd, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags);
+int32_t proc_munmap(uintptr_t addr, uint32_t length);
+void* proc_map_shared(uintptr_t addr, uint32_t size);
\ No newline at end of file
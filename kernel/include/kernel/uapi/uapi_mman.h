@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PROT_READ  1
+#define PROT_WRITE 2
+
+#define MAP_SHARED  1
+#define MAP_PRIVATE 2
+
+#define MAP_FAILED ((void*) -1)
+
+/* Arguments of the `SYS_MMAP` system call.
+ */
+typedef struct {
+    uint32_t length;
+    uint32_t prot;
+    uint32_t flags;
+    uint32_t fd;
+    uint32_t offset; // Must be a multiple of the page size
+} sys_mmap_t;
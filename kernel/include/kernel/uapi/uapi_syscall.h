@@ -26,11 +26,19 @@
 #define SYS_RENAME 20
 #define SYS_MAKETTY 21
 #define SYS_STAT 22
-#define SYS_MAX 23 // First invalid syscall number
+#define SYS_FORK 23
+#define SYS_EXECVE 24
+#define SYS_GETDENTS 25
+#define SYS_SYNC 26
+#define SYS_MMAP 27
+#define SYS_MUNMAP 28
+#define SYS_MAX 29 // First invalid syscall number
 
 #define SYS_INFO_UPTIME 1
 #define SYS_INFO_MEMORY 2
 #define SYS_INFO_LOG    4
+#define SYS_INFO_PROC   8
+#define SYS_INFO_CACHE  16
 
 typedef struct {
     uint32_t kernel_heap_usage;
@@ -38,6 +46,9 @@ typedef struct {
     uint32_t ram_total;
     float uptime;
     char* kernel_log; // Must be at least 2048 bytes long
+    uint32_t minor_faults; // Of the calling process
+    uint32_t page_cache_hits; // Pages read from the page cache
+    uint32_t page_cache_misses; // Pages read from their filesystem
 } sys_info_t;
 
 typedef struct {
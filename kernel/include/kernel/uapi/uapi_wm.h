@@ -55,6 +55,10 @@ typedef struct {
     wm_kbd_event_t kbd;
 } wm_event_t;
 
+/* Parameters of `WM_CMD_OPEN`. If `fb->address` is zero, the WM allocates the
+ * window's buffer and maps it in the caller's address space, writing its
+ * address to `fb->address`: the window is then rendered without copies.
+ */
 typedef struct {
     fb_t* fb;
     uint32_t flags;
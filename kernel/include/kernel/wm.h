@@ -10,9 +10,22 @@
 #include <kernel/uapi/uapi_wm.h>
 
 #define WM_NOT_DRAWN  ((uint32_t) 1 << 31) // Window has _never_ been called wm_render_window
+#define WM_SHARED     ((uint32_t) 1 << 30) // `ufb` and `kfb` share their pages
+
+// We exposed `wm_rect_t` to userspace, rename it here for convenience
+typedef wm_rect_t rect_t;
+
+/* A set of pixels, as a list of disjoint rects. See `region.c`.
+ */
+typedef struct region_t {
+    uint32_t count;
+    uint32_t capacity; // Zero if `rects` isn't owned by the region
+    rect_t* rects;
+} region_t;
 
 /* ufb: the window's buffer in userspace. Used by the client for drawing
- *  operations. We copy this buffer on request to `kfb`.
+ *  operations. We copy this buffer on request to `kfb`, unless the window has
+ *  a shared surface: then both map the same memory, and nothing is copied.
  * kfb: the drawn window's buffer held by the WM. This is used to redraw the
  *  window when we're not in the window's address space.
  */
@@ -24,24 +37,33 @@ typedef struct _wm_window_t {
     uint32_t id;
     uint32_t flags;
     ringbuffer_t* events;
+    uint32_t pid; // Of the process that opened the window
+    region_t visible; // On screen, i.e. not covered by the windows above
 } wm_window_t;
 
-// We exposed `wm_rect_t` to userspace, rename it here for convenience
-typedef wm_rect_t rect_t;
-
 void init_wm();
 
 uint32_t wm_open_window(fb_t* fb, uint32_t flags);
 void wm_close_window(uint32_t win_id);
 void wm_render_window(uint32_t win_id, rect_t* clip);
 void wm_get_event(uint32_t win_id, wm_event_t* event);
+void wm_release_surfaces();
 
 // rect-handling functions
-rect_t* rect_new_copy(rect_t r);
-list_t* rect_split_by(rect_t a, rect_t b);
 rect_t rect_from_window(wm_window_t* win);
-void rect_subtract_clip_rect(list_t* rects, rect_t clip);
-void rect_add_clip_rect(list_t* rects, rect_t clip);
 void print_rect(rect_t* r);
 bool rect_intersect(rect_t a, rect_t b);
-void rect_clear_clipped(list_t* rects);
\ No newline at end of file
+rect_t rect_clip(rect_t a, rect_t b);
+
+// region-handling functions
+void region_init(region_t* reg);
+void region_init_rect(region_t* reg, rect_t rect);
+void region_fini(region_t* reg);
+void region_copy(region_t* dst, const region_t* src);
+void region_union(region_t* dst, const region_t* a, const region_t* b);
+void region_subtract(region_t* dst, const region_t* a, const region_t* b);
+void region_intersect(region_t* dst, const region_t* a, const region_t* b);
+void region_union_rect(region_t* reg, rect_t rect);
+void region_subtract_rect(region_t* reg, rect_t rect);
+void region_intersect_rect(region_t* reg, rect_t rect);
+void region_translate(region_t* reg, int32_t dx, int32_t dy);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <kernel/fb.h>
 #include <kernel/paging.h>
+#include <kernel/pat.h>
 #include <kernel/pmm.h>
 #include <kernel/sys.h>
 
@@ -25,16 +26,11 @@ void init_fb(mb2_t* boot) {
 
     uintptr_t address = (uintptr_t) fb_info->addr;
 
-    // Remap our framebuffer
+    // Map our framebuffer write-combining: we only ever write to it
     uint32_t size = fb.height*fb.pitch;
-    uintptr_t buff = (uintptr_t) kamalloc(size, 0x1000);
+    uint32_t flags = PAGE_RW | pat_write_combining(address, size);
 
-    for (uint32_t i = 0; i < size/0x1000; i++) {
-        page_t* p = paging_get_page(buff + 0x1000*i, false, 0);
-        *p = (address + 0x1000*i) | PAGE_PRESENT | PAGE_RW;
-    }
-
-    fb.address = buff;
+    fb.address = (uintptr_t) paging_map_kernel(address, size, flags);
 }
 
 fb_t fb_get_info() {
@@ -46,6 +46,12 @@ void fpu_switch(process_t* prev, const process_t* next) {
     memcpy(kernel_fpu, next->fpu_registers, 512);
 }
 
+/* Copies the fpu state of the process that entered the kernel to `process`.
+ */
+void fpu_save_state(process_t* process) {
+    memcpy(process->fpu_registers, kernel_fpu, 512);
+}
+
 /* Called when execution enters the kernel: the fpu state is saved, then
  * cleared, so the kernel gets a fresh start.
  */
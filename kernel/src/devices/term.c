@@ -48,13 +48,9 @@ void init_term() {
 
     ansi_init_context(&ctx);
 
-    // Remap the terminal's buffer in the kernel heap.
-    // We allocate a full page as we're going to modify it manually
+    // Remap the terminal's buffer in kernel space
     // Note that `size` is 4000 bytes, a page is 4096 bytes
-    uintptr_t buff = (uintptr_t) kamalloc(0x1000, 0x1000);
-    page_t* p = paging_get_page((uintptr_t) buff, false, 0);
-    *p = TERM_MEMORY | PAGE_PRESENT | PAGE_RW;
-    term_buffer = (uint16_t*) buff;
+    term_buffer = paging_map_kernel(TERM_MEMORY, 0x1000, PAGE_RW);
 }
 
 void term_change_bg_color(term_color_t bg) {
@@ -6,7 +6,9 @@
 #include <kernel/idt.h>
 #include <kernel/irq.h>
 #include <kernel/multiboot2.h>
+#include <kernel/page_cache.h>
 #include <kernel/paging.h>
+#include <kernel/pat.h>
 #include <kernel/pmm.h>
 #include <kernel/proc.h>
 #include <kernel/ps2.h>
@@ -43,6 +45,7 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
     printk("kernel is %d KiB large", ((uint32_t) &KERNEL_SIZE) >> 10);
 
     init_fpu();
+    init_pat();
     init_fb(boot);
     init_gdt();
     init_idt();
@@ -52,6 +55,7 @@ void kernel_main(mb2_t* boot, uint32_t magic) {
 
     init_timer();
     init_ps2();
+    init_page_cache();
 
     // Load GRUB modules as programs
     mb2_tag_t* tag = boot->tags;
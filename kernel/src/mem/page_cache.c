@@ -0,0 +1,287 @@
+#include <kernel/page_cache.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/sys.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Slot of `paging_map_temp` through which cached pages are accessed.
+ */
+#define TEMP_SLOT 2
+
+static kmem_cache_t* page_cache;
+static cached_page_t* buckets[PAGE_CACHE_BUCKETS];
+static list_t lru; // Least recently used first
+static uint32_t num_pages = 0;
+static uint32_t hits = 0;
+static uint32_t misses = 0;
+
+void init_page_cache() {
+    page_cache = kmem_cache_create("cached_page_t", sizeof(cached_page_t), 0);
+    lru = LIST_HEAD_INIT(lru);
+}
+
+/* Only files of filesystems that can write at an offset are cached: the
+ * others, such as pipes, are streams.
+ */
+static bool page_cacheable(inode_t* in) {
+    return in->type == DENT_FILE && in->fs->write_at;
+}
+
+/* Consecutive pages of a file land in consecutive buckets.
+ */
+static uint32_t page_bucket(uint32_t fs_uid, uint32_t inode_no, uint32_t index) {
+    return (fs_uid*7919 + inode_no*131 + index) % PAGE_CACHE_BUCKETS;
+}
+
+/* Returns the cached page `index` of `in`, marking it as the most recently
+ * used one, or NULL if it isn't cached.
+ */
+static cached_page_t* page_lookup(inode_t* in, uint32_t index) {
+    cached_page_t* page = buckets[page_bucket(in->fs->uid, in->inode_no, index)];
+
+    while (page) {
+        if (page->fs_uid == in->fs->uid && page->inode_no == in->inode_no
+                && page->index == index) {
+            __list_del(page->lru.prev, page->lru.next);
+            __list_add(&page->lru, lru.prev, &lru);
+
+            return page;
+        }
+
+        page = page->next;
+    }
+
+    return NULL;
+}
+
+/* Drops the cache's reference to the frame of `page`, and frees it.
+ */
+static void page_evict(cached_page_t* page) {
+    cached_page_t** link = &buckets[page_bucket(page->fs_uid, page->inode_no, page->index)];
+
+    while (*link != page) {
+        link = &(*link)->next;
+    }
+
+    *link = page->next;
+    __list_del(page->lru.prev, page->lru.next);
+    pmm_free_page(page->frame);
+    kmem_cache_free(page_cache, page);
+    num_pages--;
+}
+
+/* Reads the page `index` of `in` from its filesystem, and caches it.
+ * Returns NULL if we're out of memory.
+ */
+static cached_page_t* page_fill(inode_t* in, uint32_t index) {
+    // Mapped pages stay cached, so that mappings keep seeing writes to the file
+    if (num_pages >= PAGE_CACHE_MAX_PAGES) {
+        list_t* iter;
+        cached_page_t* page;
+
+        list_for_each(iter, page, &lru) {
+            if (!pmm_page_shared(page->frame)) {
+                page_evict(page);
+                break;
+            }
+        }
+    }
+
+    uintptr_t frame = pmm_alloc_page();
+
+    if (!frame) {
+        return NULL;
+    }
+
+    uint8_t* data = paging_map_temp(TEMP_SLOT, frame);
+    uint32_t read = in->fs->read(in->fs, in->inode_no, index*0x1000, data, 0x1000);
+    memset(data + read, 0, 0x1000 - read);
+
+    cached_page_t* page = kmem_cache_alloc(page_cache);
+    uint32_t bucket = page_bucket(in->fs->uid, in->inode_no, index);
+
+    *page = (cached_page_t) {
+        .fs_uid = in->fs->uid,
+        .inode_no = in->inode_no,
+        .index = index,
+        .frame = frame,
+        .next = buckets[bucket]
+    };
+
+    buckets[bucket] = page;
+    page->lru.data = page;
+    __list_add(&page->lru, lru.prev, &lru);
+    num_pages++;
+
+    return page;
+}
+
+/* Evicts the cached pages of `in` starting from the page `first`.
+ */
+static void page_drop(inode_t* in, uint32_t first) {
+    list_t* iter;
+    list_t* n;
+
+    list_for_each_safe(iter, n, &lru) {
+        cached_page_t* page = list_entry(iter, cached_page_t);
+
+        if (page->fs_uid == in->fs->uid && page->inode_no == in->inode_no
+                && page->index >= first) {
+            page_evict(page);
+        }
+    }
+}
+
+/* Reads up to `size` bytes at `offset` in the file `in`, through the cache.
+ * `ra` tracks how the file descriptor is being read: while reads follow each
+ * other, a growing window of pages past the one read is cached in advance, so
+ * that the next reads are served from memory.
+ * Returns the number of bytes read.
+ */
+uint32_t page_cache_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size, readahead_t* ra) {
+    if (!page_cacheable(in)) {
+        return fs_read(in, offset, buf, size);
+    }
+
+    if (offset >= in->size || !size) {
+        return 0;
+    }
+
+    size = min(size, in->size - offset);
+
+    if (offset == ra->next) {
+        ra->window = ra->window ? min(2*ra->window, READAHEAD_MAX_PAGES) : READAHEAD_MIN_PAGES;
+    } else {
+        ra->window = 0;
+        ra->ahead = 0;
+    }
+
+    uint32_t first = offset / 0x1000;
+    uint32_t last = (offset + size - 1) / 0x1000;
+    uint32_t done = 0;
+
+    for (uint32_t index = first; index <= last; index++) {
+        cached_page_t* page = page_lookup(in, index);
+
+        if (page) {
+            hits++;
+        } else {
+            misses++;
+            page = page_fill(in, index);
+        }
+
+        // Without memory to spare, bypass the cache
+        if (!page) {
+            done += fs_read(in, offset + done, buf + done, size - done);
+            break;
+        }
+
+        uint32_t from = (offset + done) % 0x1000;
+        uint32_t len = min(0x1000 - from, size - done);
+        uint8_t* data = paging_map_temp(TEMP_SLOT, page->frame);
+
+        memcpy(buf + done, data + from, len);
+        done += len;
+    }
+
+    // The filesystem has no asynchronous I/O, so reading ahead is synchronous
+    if (ra->window) {
+        uint32_t index = max(ra->ahead, last + 1);
+        uint32_t end = min(last + 1 + ra->window, divide_up(in->size, 0x1000));
+
+        while (index < end && (page_lookup(in, index) || page_fill(in, index))) {
+            index++;
+        }
+
+        ra->ahead = index;
+    }
+
+    ra->next = offset + done;
+
+    return done;
+}
+
+/* Returns the frame holding the page `index` of `in`, caching it first if
+ * needed, with a new reference to it for the caller. Returns zero for pages
+ * past the end of the file, or if it can't be cached.
+ */
+uintptr_t page_cache_get_frame(inode_t* in, uint32_t index) {
+    if (!page_cacheable(in) || index >= divide_up(in->size, 0x1000)) {
+        return 0;
+    }
+
+    cached_page_t* page = page_lookup(in, index);
+
+    if (page) {
+        hits++;
+    } else {
+        misses++;
+        page = page_fill(in, index);
+    }
+
+    if (!page) {
+        return 0;
+    }
+
+    pmm_ref_page(page->frame);
+
+    return page->frame;
+}
+
+/* Updates the cached pages of `in` after `size` bytes from `buf` were written
+ * to it at `offset`.
+ */
+void page_cache_write(inode_t* in, uint32_t offset, const uint8_t* buf, uint32_t size) {
+    if (!page_cacheable(in) || !size) {
+        return;
+    }
+
+    uint32_t done = 0;
+
+    while (done < size) {
+        uint32_t from = (offset + done) % 0x1000;
+        uint32_t len = min(0x1000 - from, size - done);
+        cached_page_t* page = page_lookup(in, (offset + done) / 0x1000);
+
+        if (page) {
+            uint8_t* data = paging_map_temp(TEMP_SLOT, page->frame);
+            memcpy(data + from, buf + done, len);
+        }
+
+        done += len;
+    }
+}
+
+/* Updates the cached pages of `in` after it was truncated to `size` bytes.
+ */
+void page_cache_truncate(inode_t* in, uint32_t size) {
+    if (!page_cacheable(in)) {
+        return;
+    }
+
+    page_drop(in, divide_up(size, 0x1000));
+
+    cached_page_t* page = size % 0x1000 ? page_lookup(in, size / 0x1000) : NULL;
+
+    if (page) {
+        uint8_t* data = paging_map_temp(TEMP_SLOT, page->frame);
+        memset(data + size % 0x1000, 0, 0x1000 - size % 0x1000);
+    }
+}
+
+/* Evicts every cached page of `in`, as its inode is being freed.
+ */
+void page_cache_invalidate(inode_t* in) {
+    page_drop(in, 0);
+}
+
+uint32_t page_cache_hits() {
+    return hits;
+}
+
+uint32_t page_cache_misses() {
+    return misses;
+}
@@ -13,7 +13,17 @@
 #define DIRECTORY_INDEX(x) ((x) >> 22)
 #define TABLE_INDEX(x) (((x) >> 12) & 0x3FF)
 
+/* Number of kernel pages reserved for `paging_map_temp`. The last one is the
+ * page cache's, as its users can fault on the other ones.
+ */
+#define TEMP_SLOTS 3
+
 static directory_entry_t* current_page_directory;
+static uintptr_t temp_pages = 0;
+
+// Next free addresses for `paging_map_kernel`
+static uintptr_t kernel_map_small = KERNEL_MAP_BEGIN;
+static uintptr_t kernel_map_large = KERNEL_MAP_LARGE_BEGIN;
 
 extern directory_entry_t kernel_directory[1024];
 
@@ -32,6 +42,14 @@ void init_paging(mb2_t* boot) {
     paging_map_pages(0x00000000, 0x00000000, to_map, PAGE_RW);
     paging_invalidate_page(0x00000000);
     current_page_directory = kernel_directory;
+
+    // Reserve the pages of `paging_map_temp`
+    temp_pages = kernel_map_small;
+    kernel_map_small += TEMP_SLOTS*0x1000;
+
+    for (uint32_t i = 0; i < TEMP_SLOTS; i++) {
+        paging_get_page(temp_pages + i*0x1000, true, 0);
+    }
 }
 
 uintptr_t paging_get_kernel_directory() {
@@ -43,7 +61,8 @@ uintptr_t paging_get_kernel_directory() {
  * information such as the physical address it points to, whether it is writable
  * etc...
  * If the `create` flag is passed, the corresponding page table is created with
- * the passed flags if needed and this function should never return NULL.
+ * the passed flags if needed and this function should only return NULL for
+ * addresses mapped by 4 MiB pages, which have no page table.
  */
 page_t* paging_get_page(uintptr_t virt, bool create, uint32_t flags) {
     if (virt % 0x1000) {
@@ -64,17 +83,24 @@ page_t* paging_get_page(uintptr_t virt, bool create, uint32_t flags) {
         memset((void*) table, 0, 4096);
     }
 
-    if (dir[dir_index] & PAGE_PRESENT) {
+    if (dir[dir_index] & PAGE_PRESENT && !(dir[dir_index] & PAGE_LARGE)) {
         return &table[table_index];
     }
 
     return NULL;
 }
 
-// TODO: refuse 4 MiB pages
+/* Maps `virt` to `phys`. Kernel pages are mapped in every address space, so
+ * they're made global.
+ */
 void paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
     page_t* page = paging_get_page(virt, true, flags);
 
+    if (!page) {
+        printke("tried to map 0x%X inside a 4 MiB page", virt);
+        abort();
+    }
+
     if (*page & PAGE_PRESENT) {
         printke("tried to map an already mapped virtual address 0x%X to 0x%X",
             virt, phys);
@@ -82,6 +108,10 @@ void paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
         abort();
     }
 
+    if (virt >= KERNEL_BASE_VIRT) {
+        flags |= PAGE_GLOBAL;
+    }
+
     *page = phys | PAGE_PRESENT | (flags & PAGE_FLAGS);
     paging_invalidate_page(virt);
 }
@@ -89,9 +119,10 @@ void paging_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
 void paging_unmap_page(uintptr_t virt) {
     page_t* page = paging_get_page(virt, false, 0);
 
-    if (page) {
+    if (page && *page & PAGE_PRESENT) {
         pmm_free_page(*page & PAGE_FRAME);
         *page = 0;
+        paging_invalidate_page(virt);
     }
 }
 
@@ -103,6 +134,68 @@ void paging_map_pages(uintptr_t virt, uintptr_t phys, uint32_t num, uint32_t fla
     }
 }
 
+/* Maps the 4 MiB of physical memory at `phys` to `virt` with a single
+ * directory entry. Both addresses must be aligned to 4 MiB.
+ */
+void paging_map_large_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
+    directory_entry_t* dir = (directory_entry_t*) 0xFFFFF000;
+    uint32_t dir_index = DIRECTORY_INDEX(virt);
+
+    if (virt % LARGE_PAGE_SIZE || phys % LARGE_PAGE_SIZE) {
+        printke("unaligned large page mapping of 0x%X to 0x%X", virt, phys);
+        abort();
+    }
+
+    if (dir[dir_index] & PAGE_PRESENT) {
+        printke("tried to map an already mapped large page at 0x%X", virt);
+        abort();
+    }
+
+    if (virt >= KERNEL_BASE_VIRT) {
+        flags |= PAGE_GLOBAL;
+    }
+
+    dir[dir_index] = phys | PAGE_PRESENT | PAGE_LARGE | (flags & PAGE_FLAGS);
+    paging_invalidate_page(virt);
+}
+
+/* Maps the `size` bytes of physical memory at `phys` in kernel space, and
+ * returns the address corresponding to `phys`. Areas starting on a 4 MiB
+ * boundary are mapped with 4 MiB pages.
+ */
+void* paging_map_kernel(uintptr_t phys, uint32_t size, uint32_t flags) {
+    uintptr_t offset = phys & 0xFFF;
+    uintptr_t first = phys & PAGE_FRAME;
+    uint32_t num = divide_up(offset + size, 0x1000);
+    uintptr_t virt;
+
+    if (first % LARGE_PAGE_SIZE == 0 && size > 0x1000) {
+        virt = kernel_map_large;
+        uint32_t num_large = divide_up(num*0x1000, LARGE_PAGE_SIZE);
+
+        for (uint32_t i = 0; i < num_large; i++) {
+            paging_map_large_page(virt + i*LARGE_PAGE_SIZE, first + i*LARGE_PAGE_SIZE, flags);
+        }
+
+        kernel_map_large += num_large*LARGE_PAGE_SIZE;
+    } else if (kernel_map_small + num*0x1000 <= KERNEL_MAP_LARGE_BEGIN) {
+        virt = kernel_map_small;
+        paging_map_pages(virt, first, num, flags);
+        kernel_map_small += num*0x1000;
+    } else {
+        virt = kernel_map_large;
+        paging_map_pages(virt, first, num, flags);
+        kernel_map_large += align_to(num*0x1000, LARGE_PAGE_SIZE);
+    }
+
+    if (kernel_map_large > KERNEL_MAP_END) {
+        printke("out of kernel address space");
+        abort();
+    }
+
+    return (void*) (virt + offset);
+}
+
 void paging_unmap_pages(uintptr_t virt, uint32_t num) {
     for (uint32_t i = 0; i < num; i++) {
         paging_unmap_page(virt);
@@ -114,6 +207,8 @@ void paging_switch_directory(uintptr_t dir_phys) {
     asm volatile("mov %0, %%cr3\n" :: "r" (dir_phys));
 }
 
+/* Flushes the TLB of every non-global mapping, i.e. of user pages.
+ */
 void paging_invalidate_cache() {
     asm (
         "mov %cr3, %eax\n"
@@ -125,6 +220,34 @@ void paging_invalidate_page(uintptr_t virt) {
     asm volatile ("invlpg (%0)" :: "b"(virt) : "memory");
 }
 
+/* Gives the current process its own copy of a copy-on-write page, if `virt`
+ * is in such a page. Returns whether it was.
+ */
+static bool paging_handle_cow(uintptr_t virt) {
+    uintptr_t addr = virt & PAGE_FRAME;
+    page_t* page = paging_get_page(addr, false, 0);
+
+    if (!page || !(*page & PAGE_COW)) {
+        return false;
+    }
+
+    uintptr_t phys = *page & PAGE_FRAME;
+    uint32_t flags = (*page & PAGE_FLAGS & ~PAGE_COW) | PAGE_RW;
+
+    // The last process to write to the page can have it for itself
+    if (pmm_page_shared(phys)) {
+        uintptr_t copy = pmm_alloc_page();
+        memcpy(paging_map_temp(1, copy), (void*) addr, 0x1000);
+        pmm_free_page(phys);
+        phys = copy;
+    }
+
+    *page = phys | flags;
+    paging_invalidate_page(addr);
+
+    return true;
+}
+
 void paging_fault_handler(registers_t* regs) {
     if (!regs) {
         printke("weird page fault");
@@ -136,6 +259,16 @@ void paging_fault_handler(registers_t* regs) {
     uintptr_t cr2 = 0;
     asm volatile("mov %%cr2, %0\n" : "=r"(cr2));
 
+    // The page may belong to the process, just not be mapped yet
+    if (!(err & 0x01) && cr2 < KERNEL_BASE_VIRT && proc_map_lazy_page(cr2)) {
+        return;
+    }
+
+    // Or it may be shared with another process, until now
+    if ((err & 0x03) == 0x03 && cr2 < KERNEL_BASE_VIRT && paging_handle_cow(cr2)) {
+        return;
+    }
+
     printke("page fault caused by instruction at %p from process %d:",
         regs->eip, pid);
     printke("the page at %p %s present ", cr2, err & 0x01 ? "was" : "wasn't");
@@ -187,10 +320,99 @@ void* paging_alloc_pages(uint32_t virt, uintptr_t size) {
     return (void*) virt;
 }
 
+/* Maps the physical page `phys` at a kernel address reserved to `slot`, and
+ * returns that address. The mapping lasts until the slot is reused.
+ */
+void* paging_map_temp(uint32_t slot, uintptr_t phys) {
+    uintptr_t virt = temp_pages + slot*0x1000;
+    page_t* page = paging_get_page(virt, false, 0);
+
+    *page = phys | PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL;
+    paging_invalidate_page(virt);
+
+    return (void*) virt;
+}
+
+/* Returns the physical address of a new page directory, with the same kernel
+ * mappings as the current one and sharing its user pages. Writable user pages
+ * become copy-on-write pages in both directories, unless they're meant to be
+ * shared.
+ */
+uintptr_t paging_fork_directory() {
+    directory_entry_t* dir = (directory_entry_t*) 0xFFFFF000;
+    uintptr_t pd_phys = pmm_alloc_page();
+    directory_entry_t* pd = paging_map_temp(0, pd_phys);
+
+    memcpy(pd, dir, 0x1000);
+    pd[1023] = pd_phys | PAGE_PRESENT | PAGE_RW;
+
+    for (uint32_t i = 0; i < DIRECTORY_INDEX(KERNEL_BASE_VIRT); i++) {
+        if (!(dir[i] & PAGE_PRESENT)) {
+            continue;
+        }
+
+        page_t* table = (page_t*) (0xFFC00000 + (i << 12));
+        uintptr_t table_phys = pmm_alloc_page();
+        page_t* new_table = paging_map_temp(1, table_phys);
+
+        for (uint32_t j = 0; j < 1024; j++) {
+            if (table[j] & PAGE_PRESENT) {
+                if (table[j] & PAGE_RW && !(table[j] & PAGE_SHARED)) {
+                    table[j] = (table[j] & ~PAGE_RW) | PAGE_COW;
+                }
+
+                pmm_ref_page(table[j] & PAGE_FRAME);
+            }
+
+            new_table[j] = table[j];
+        }
+
+        pd[i] = table_phys | (dir[i] & PAGE_FLAGS);
+    }
+
+    // We write-protected our own pages
+    paging_invalidate_cache();
+
+    return pd_phys;
+}
+
+/* Unmaps every user page of the current page directory, and frees them along
+ * with their page tables.
+ */
+void paging_free_user_space() {
+    directory_entry_t* dir = (directory_entry_t*) 0xFFFFF000;
+
+    for (uint32_t i = 0; i < DIRECTORY_INDEX(KERNEL_BASE_VIRT); i++) {
+        if (!(dir[i] & PAGE_PRESENT)) {
+            continue;
+        }
+
+        page_t* table = (page_t*) (0xFFC00000 + (i << 12));
+
+        for (uint32_t j = 0; j < 1024; j++) {
+            if (table[j] & PAGE_PRESENT) {
+                pmm_free_page(table[j] & PAGE_FRAME);
+            }
+        }
+
+        pmm_free_page(dir[i] & PAGE_FRAME);
+        dir[i] = 0;
+    }
+
+    paging_invalidate_cache();
+}
+
 /* Returns the current physical mapping of `virt` if it exists, zero
  * otherwise.
  */
 uintptr_t paging_virt_to_phys(uintptr_t virt) {
+    directory_entry_t* dir = (directory_entry_t*) 0xFFFFF000;
+    directory_entry_t entry = dir[DIRECTORY_INDEX(virt)];
+
+    if ((entry & PAGE_PRESENT) && (entry & PAGE_LARGE)) {
+        return (entry & ~(LARGE_PAGE_SIZE - 1)) + (virt & (LARGE_PAGE_SIZE - 1));
+    }
+
     page_t* p = paging_get_page(virt & PAGE_FRAME, false, 0);
 
     if (!p) {
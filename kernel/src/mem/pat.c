@@ -0,0 +1,178 @@
+#include <kernel/pat.h>
+#include <kernel/paging.h>
+#include <kernel/sys.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define CPUID_FEAT_EDX_MTRR (1 << 12)
+#define CPUID_FEAT_EDX_PAT (1 << 16)
+
+#define MSR_MTRR_CAP 0xFE
+#define MSR_MTRR_PHYS_BASE(n) (0x200 + 2*(n))
+#define MSR_MTRR_PHYS_MASK(n) (0x201 + 2*(n))
+#define MSR_PAT 0x277
+#define MSR_MTRR_DEF_TYPE 0x2FF
+
+#define MTRR_CAP_VCNT 0xFF
+#define MTRR_CAP_WC (1 << 10)
+#define MTRR_VALID (1 << 11)
+#define MTRR_DEF_TYPE_E (1 << 11)
+
+#define MEMTYPE_WC 0x01
+
+#define CR0_NW (1 << 29)
+#define CR0_CD (1 << 30)
+#define CR4_PGE (1 << 7)
+
+/* The PAT entry selected by `PAGE_WRITE_THROUGH` alone is reprogrammed from
+ * write-through to write-combining, so that the flag means the same for
+ * 4 KiB and 4 MiB pages. Write-through isn't used anywhere.
+ */
+#define PAT_WC_ENTRY 1
+
+static bool has_pat = false;
+
+static void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile("cpuid"
+        : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+        : "a"(leaf), "c"(0));
+}
+
+static uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+
+    return ((uint64_t) high << 32) | low;
+}
+
+static void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t) value), "d"((uint32_t) (value >> 32)));
+}
+
+/* Returns the width of physical addresses in bits.
+ */
+static uint32_t phys_address_bits() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+
+    if (eax < 0x80000008) {
+        return 36;
+    }
+
+    cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
+
+    return eax & 0xFF;
+}
+
+/* Sets up the PAT if the CPU has one.
+ */
+void init_pat() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_FEAT_EDX_PAT)) {
+        printk("no PAT, falling back to MTRRs for write-combining");
+        return;
+    }
+
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat &= ~((uint64_t) 0xFF << (8*PAT_WC_ENTRY));
+    pat |= (uint64_t) MEMTYPE_WC << (8*PAT_WC_ENTRY);
+
+    asm volatile("wbinvd");
+    wrmsr(MSR_PAT, pat);
+    paging_invalidate_cache();
+
+    has_pat = true;
+}
+
+/* Makes the physical range of `size` bytes at `phys` write-combining using a
+ * free variable range MTRR. The range is grown to a power of two, as MTRRs
+ * require, and must be aligned to that size. Follows the update procedure of
+ * the Intel manual, vol. 3, 11.11.7.2.
+ * Note: another MTRR making part of the range uncacheable takes precedence.
+ */
+static bool pat_set_mtrr(uintptr_t phys, uint32_t size) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_FEAT_EDX_MTRR)) {
+        return false;
+    }
+
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+
+    if (!(cap & MTRR_CAP_WC)) {
+        return false;
+    }
+
+    uint32_t range = 0x1000;
+
+    while (range < size) {
+        range <<= 1;
+    }
+
+    if (phys % range) {
+        return false;
+    }
+
+    uint32_t count = cap & MTRR_CAP_VCNT;
+    uint32_t free = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(rdmsr(MSR_MTRR_PHYS_MASK(i)) & MTRR_VALID)) {
+            free = i;
+            break;
+        }
+    }
+
+    if (free == count) {
+        return false;
+    }
+
+    uint64_t addr_mask = ((uint64_t) 1 << phys_address_bits()) - 1;
+    uint64_t mask = ~((uint64_t) range - 1) & addr_mask & ~(uint64_t) 0xFFF;
+    uint32_t cr0, cr4;
+
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+
+    // Disable caching, flush caches and the TLB, global pages included
+    asm volatile("mov %0, %%cr0" :: "r"((cr0 | CR0_CD) & ~CR0_NW));
+    asm volatile("wbinvd");
+    asm volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE));
+    paging_invalidate_cache();
+
+    uint64_t def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type & ~MTRR_DEF_TYPE_E);
+
+    wrmsr(MSR_MTRR_PHYS_BASE(free), phys | MEMTYPE_WC);
+    wrmsr(MSR_MTRR_PHYS_MASK(free), mask | MTRR_VALID);
+
+    asm volatile("wbinvd");
+    paging_invalidate_cache();
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+
+    asm volatile("mov %0, %%cr0" :: "r"(cr0));
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+
+    return true;
+}
+
+/* Returns the page flags mapping the `size` bytes of physical memory at `phys`
+ * as write-combining. With a PAT, that's `PAGE_WRITE_THROUGH`, see
+ * `PAT_WC_ENTRY`. Otherwise, the range is made write-combining with an MTRR
+ * if possible, and no flag is needed.
+ */
+uint32_t pat_write_combining(uintptr_t phys, uint32_t size) {
+    if (has_pat) {
+        return PAGE_WRITE_THROUGH;
+    }
+
+    if (!pat_set_mtrr(phys, size)) {
+        printke("couldn't make %p write-combining", phys);
+    }
+
+    return 0;
+}
@@ -8,12 +8,45 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define NTHBIT(n) ((uint32_t) 1 << n)
+#define NTHBIT(n) ((uint32_t) 1 << (n))
 
-static uint32_t bitmap[1024 * 1024 / 32];
+/* Physical memory is handed out by a buddy allocator: free memory is kept as
+ * naturally aligned blocks of 2^order pages, one free list per order. The
+ * largest blocks are 4 MiB large, i.e. large pages.
+ */
+#define MAX_ORDER 10
+
+/* `orders[block]` holds the order of the free block starting at `block` with
+ * this flag set, or zero if no free block starts there.
+ */
+#define ORDER_FREE 0x80
+
+/* Block zero is never free, so it doubles as the end of free lists.
+ */
+#define NO_BLOCK 0
+
+/* Define to check every allocation and free against the bitmap, catching
+ * double frees and overlapping allocations.
+ */
+// #define PMM_DEBUG
+
+typedef struct {
+    uint32_t next;
+    uint32_t prev;
+} frame_link_t;
+
+// The bitmap describes memory at boot, and is otherwise a debugging aid
+static uint32_t bitmap[PMM_MAX_BLOCKS / 32];
+static frame_link_t links[PMM_MAX_BLOCKS];
+static uint8_t orders[PMM_MAX_BLOCKS];
+
+// References to allocated pages beyond the first one, for shared pages
+static uint16_t refcounts[PMM_MAX_BLOCKS];
+static uint32_t free_lists[MAX_ORDER + 1];
 static uint32_t mem_size;
 static uint32_t used_blocks;
 static uint32_t max_blocks;
+static uint32_t top_block; // One past the last available block
 static uintptr_t kernel_end;
 
 // Linker-provided symbols. Beware, those don't take into account GRUB's things
@@ -23,8 +56,15 @@ extern uint32_t KERNEL_END_PHYS;
 void mmap_set(uint32_t bit);
 void mmap_unset(uint32_t bit);
 uint32_t mmap_test(uint32_t bit);
-uint32_t mmap_find_free();
-uint32_t mmap_find_free_frame(uint32_t num);
+
+static void buddy_init();
+static uint32_t buddy_alloc(uint32_t order);
+static void buddy_free(uint32_t block, uint32_t order);
+static void buddy_free_range(uint32_t block, uint32_t num);
+static void buddy_take_range(uint32_t block, uint32_t num);
+static uint32_t buddy_find_free_run(uint32_t num);
+static uint32_t buddy_order(uint32_t num);
+static void pmm_debug_mark(uint32_t block, uint32_t num, bool used);
 
 void init_pmm(mb2_t* boot) {
     // Compute where the kernel & GRUB modules end in physical memory
@@ -56,14 +96,26 @@ void init_pmm(mb2_t* boot) {
     // Parse the memory map to mark valid areas as available
     uint64_t available = 0;
     uint64_t unavailable = 0;
+    uint64_t ignored = 0;
 
     mb2_tag_mmap_t* mmap = (mb2_tag_mmap_t*) mb2_find_tag(boot, MB2_TAG_MMAP);
     mb2_mmap_entry_t* ent = mmap->entries;
 
     while ((uintptr_t) ent < (uintptr_t) mmap + mmap->header.size) {
         if (ent->type == MB2_MMAP_AVAIL) {
-            pmm_init_region((uintptr_t) ent->base_addr, ent->length);
-            available += ent->length;
+            uint64_t end = ent->base_addr + ent->length;
+
+            // We only track a limited amount of physical memory
+            if (end > PMM_MAX_MEMORY) {
+                end = ent->base_addr > PMM_MAX_MEMORY ? ent->base_addr : PMM_MAX_MEMORY;
+                ignored += ent->base_addr + ent->length - end;
+            }
+
+            if (end > ent->base_addr) {
+                pmm_init_region((uintptr_t) ent->base_addr, end - ent->base_addr);
+                available += end - ent->base_addr;
+                top_block = max(top_block, divide_up(end, PMM_BLOCK_SIZE));
+            }
         } else {
             unavailable += ent->length;
         }
@@ -73,16 +125,21 @@ void init_pmm(mb2_t* boot) {
 
     mem_size = available;
     max_blocks = mem_size / PMM_BLOCK_SIZE;
-    used_blocks = max_blocks;
 
     // Protect low memory, our glorious kernel and its modules
     pmm_deinit_region(0, kernel_end);
     pmm_deinit_region((uintptr_t) boot, boot->total_size);
 
+    buddy_init();
+
     printk("memory stats: available: \x1B[32m%d MiB\x1B[0m", available >> 20);
     printk("unavailable: \x1B[32m%d KiB\x1B[0m", unavailable >> 10);
     printk("taken by modules: \x1B[32m%d MiB\x1B[0m",
         (kernel_end - (uintptr_t) &KERNEL_END_PHYS) >> 20);
+
+    if (ignored) {
+        printk("ignored: \x1B[32m%d MiB\x1B[0m", (uint32_t) (ignored >> 20));
+    }
 }
 
 /* Returns the number of bytes allocated by the PMM.
@@ -98,13 +155,14 @@ uint32_t pmm_total_memory() {
 }
 
 /* Mark an area of physical memory as available.
+ * Note: only meaningful before the buddy allocator is built in `init_pmm`.
  */
 void pmm_init_region(uintptr_t addr, uint32_t size) {
     uint32_t base_block = addr/PMM_BLOCK_SIZE;
     /* A region might be smaller than a block, yet span two: boundaries */
     uint32_t num = divide_up(size + addr % PMM_BLOCK_SIZE, PMM_BLOCK_SIZE);
 
-    while (num-- > 0) {
+    while (num-- > 0 && base_block < PMM_MAX_BLOCKS) {
         mmap_unset(base_block++);
     }
 
@@ -113,12 +171,13 @@ void pmm_init_region(uintptr_t addr, uint32_t size) {
 }
 
 /* Mark an area of physical memory as used.
+ * Note: only meaningful before the buddy allocator is built in `init_pmm`.
  */
 void pmm_deinit_region(uintptr_t addr, uint32_t size) {
     uint32_t base_block = addr/PMM_BLOCK_SIZE;
     uint32_t num = divide_up(size + addr % PMM_BLOCK_SIZE, PMM_BLOCK_SIZE);
 
-    while (num-- > 0) {
+    while (num-- > 0 && base_block < PMM_MAX_BLOCKS) {
         mmap_set(base_block++);
     }
 }
@@ -127,144 +186,353 @@ void pmm_deinit_region(uintptr_t addr, uint32_t size) {
  * Note: of course, this address is page-aligned.
  */
 uintptr_t pmm_alloc_page() {
-    if (max_blocks - used_blocks <= 0) {
+    uint32_t block = buddy_alloc(0);
+
+    if (!block) {
         printke("kernel is out of physical memory!");
         abort();
     }
 
-    uint32_t block = mmap_find_free();
-
-    if (!block)  {
-        return 0;
-    }
-
-    mmap_set(block);
+    pmm_debug_mark(block, 1, true);
 
     return (uintptr_t) (block*PMM_BLOCK_SIZE);
 }
 
 /* Returns the address of a 4 MiB area of physical memory, aligned to 4 MiB.
- *
- * Strategy:
- * Find an 8 MiB section of memory. In there, we are guaranteed to find an
- * address that is 4 MiB-aligned. Return that, mark 4 MiB as taken.
+ * Those are exactly the largest blocks of the buddy allocator.
  */
-uintptr_t pmm_alloc_aligned_large_page() { // TODO: generalize
-    if (max_blocks - used_blocks < 2*1024) { // 4MiB
-        return 0;
-    }
-
-    uint32_t free_block = mmap_find_free_frame(2*1024);
+uintptr_t pmm_alloc_aligned_large_page() {
+    uint32_t block = buddy_alloc(MAX_ORDER);
 
-    if (!free_block) {
+    if (!block) {
         return 0;
     }
 
-    uint32_t aligned_block = ((free_block / 1024) + 1) * 1024;
+    pmm_debug_mark(block, NTHBIT(MAX_ORDER), true);
 
-    for (int i = 0; i < 1024; i++) {
-        mmap_set(aligned_block + i);
-    }
-
-    return (uintptr_t)(aligned_block*PMM_BLOCK_SIZE);
+    return (uintptr_t) (block*PMM_BLOCK_SIZE);
 }
 
+/* Returns the address of `num` contiguous pages of physical memory, or zero if
+ * no such area is available.
+ * The area is aligned to the next power of two above `num` pages, as long as
+ * that fits within a 4 MiB large page.
+ */
 uintptr_t pmm_alloc_pages(uint32_t num) {
-    if (max_blocks-used_blocks < num) {
+    if (!num || max_blocks - used_blocks < num) {
         return 0;
     }
 
-    uint32_t first_block = mmap_find_free_frame(num);
+    uint32_t order = buddy_order(num);
+    uint32_t block;
 
-    if (!first_block) {
-        return 0;
-    }
+    if (order <= MAX_ORDER) {
+        block = buddy_alloc(order);
+
+        if (!block) {
+            return 0;
+        }
+
+        // Give back the pages we don't need
+        buddy_free_range(block + num, NTHBIT(order) - num);
+    } else {
+        // Larger than any buddy block: this is rare enough to warrant a search
+        block = buddy_find_free_run(num);
 
-    for (uint32_t i = 0; i < num; i++) {
-        mmap_set(first_block+i);
+        if (!block) {
+            return 0;
+        }
+
+        buddy_take_range(block, num);
     }
 
-    return (uintptr_t) (first_block*PMM_BLOCK_SIZE);
+    pmm_debug_mark(block, num, true);
+
+    return (uintptr_t) (block*PMM_BLOCK_SIZE);
 }
 
+/* Releases a reference to a page, freeing it when it was the last one.
+ */
 void pmm_free_page(uintptr_t addr) {
     uint32_t block = addr/PMM_BLOCK_SIZE;
-    mmap_unset(block);
+
+    if (refcounts[block]) {
+        refcounts[block]--;
+        return;
+    }
+
+    pmm_debug_mark(block, 1, false);
+    buddy_free(block, 0);
+}
+
+/* Adds a reference to an allocated page: it'll take one more call to
+ * `pmm_free_page` to free it.
+ */
+void pmm_ref_page(uintptr_t addr) {
+    refcounts[addr/PMM_BLOCK_SIZE]++;
+}
+
+/* Returns whether an allocated page has more than one reference.
+ */
+bool pmm_page_shared(uintptr_t addr) {
+    return refcounts[addr/PMM_BLOCK_SIZE] != 0;
 }
 
+/* Frees `num` pages starting at `addr`. Those need not have been allocated by
+ * a single call; any range of allocated pages can be freed.
+ * Note: references added with `pmm_ref_page` are ignored.
+ */
 void pmm_free_pages(uintptr_t addr, uint32_t num) {
     uint32_t first_block = addr/PMM_BLOCK_SIZE;
 
-    for (uint32_t i = 0; i < num; i++) {
-        mmap_unset(first_block+i);
-    }
+    pmm_debug_mark(first_block, num, false);
+    buddy_free_range(first_block, num);
 }
 
 void mmap_set(uint32_t bit) {
     bitmap[bit / 32] |= NTHBIT(bit % 32);
-    used_blocks++;
 }
 
 void mmap_unset(uint32_t bit) {
     bitmap[bit / 32] &= ~NTHBIT(bit % 32);
-    used_blocks--;
 }
 
 uint32_t mmap_test(uint32_t bit) {
     return bitmap[bit / 32] & NTHBIT(bit % 32);
 }
 
-/* Returns the index of the first free bit in the bitmap
+/* Returns the first address after the kernel in physical memory.
  */
-uint32_t mmap_find_free() {
-    for (uint32_t i = 0; i < max_blocks/32; i++) {
-        if (bitmap[i] != 0xFFFFFFFF) {
-            for (uint32_t j = 0; j < 32; j++) {
-                if (!(bitmap[i] & NTHBIT(j))) {
-                    return i * 32 + j;
-                }
-            }
+uintptr_t pmm_get_kernel_end() {
+    return (uintptr_t) kernel_end + max_blocks / 8;
+}
+
+/* Buddy allocator internals */
+
+/* Fills the free lists with the blocks left free in the bitmap.
+ */
+static void buddy_init() {
+    uint32_t block = 1;
+
+    used_blocks = max_blocks;
+
+    while (block < top_block) {
+        if (mmap_test(block)) {
+            block++;
+            continue;
+        }
+
+        uint32_t first = block;
+
+        while (block < top_block && !mmap_test(block)) {
+            block++;
+        }
+
+        buddy_free_range(first, block - first);
+    }
+}
+
+static void buddy_push(uint32_t block, uint32_t order) {
+    uint32_t head = free_lists[order];
+
+    links[block].prev = NO_BLOCK;
+    links[block].next = head;
+
+    if (head) {
+        links[head].prev = block;
+    }
+
+    free_lists[order] = block;
+    orders[block] = order | ORDER_FREE;
+}
+
+static void buddy_remove(uint32_t block, uint32_t order) {
+    frame_link_t* link = &links[block];
+
+    if (link->prev) {
+        links[link->prev].next = link->next;
+    } else {
+        free_lists[order] = link->next;
+    }
+
+    if (link->next) {
+        links[link->next].prev = link->prev;
+    }
+
+    orders[block] = 0;
+}
+
+/* Returns the first block of a free area of 2^order pages, splitting larger
+ * blocks as needed, or `NO_BLOCK` if there are none left.
+ */
+static uint32_t buddy_alloc(uint32_t order) {
+    uint32_t current = order;
+
+    while (current <= MAX_ORDER && !free_lists[current]) {
+        current++;
+    }
+
+    if (current > MAX_ORDER) {
+        return NO_BLOCK;
+    }
+
+    uint32_t block = free_lists[current];
+    buddy_remove(block, current);
+
+    // Put the upper halves we don't need back in the lists
+    while (current > order) {
+        current--;
+        buddy_push(block + NTHBIT(current), current);
+    }
+
+    used_blocks += NTHBIT(order);
+
+    return block;
+}
+
+/* Returns a block of 2^order pages to the free lists, merging it with its
+ * buddy for as long as that buddy is free too.
+ */
+static void buddy_free(uint32_t block, uint32_t order) {
+    used_blocks -= NTHBIT(order);
+
+    while (order < MAX_ORDER) {
+        uint32_t buddy = block ^ NTHBIT(order);
+
+        if (orders[buddy] != (order | ORDER_FREE)) {
+            break;
         }
+
+        buddy_remove(buddy, order);
+        block &= ~NTHBIT(order);
+        order++;
+    }
+
+    buddy_push(block, order);
+}
+
+/* Frees `num` pages starting at `block`, as the largest aligned blocks
+ * possible.
+ */
+static void buddy_free_range(uint32_t block, uint32_t num) {
+    while (num) {
+        uint32_t order = 0;
+
+        while (order < MAX_ORDER && !(block & NTHBIT(order)) && NTHBIT(order + 1) <= num) {
+            order++;
+        }
+
+        buddy_free(block, order);
+        block += NTHBIT(order);
+        num -= NTHBIT(order);
     }
+}
+
+/* Removes the `num` pages starting at `block` from the free lists, marking
+ * them as used. All of those pages must be free.
+ */
+static void buddy_take_range(uint32_t block, uint32_t num) {
+    uint32_t end = block + num;
+
+    while (block < end) {
+        uint32_t order = 0;
+        uint32_t head = block;
+
+        // Find the free block containing `block`
+        while (order <= MAX_ORDER) {
+            head = block & ~(NTHBIT(order) - 1);
+
+            if (orders[head] == (order | ORDER_FREE)) {
+                break;
+            }
+
+            order++;
+        }
 
-    return 0;
+        if (order > MAX_ORDER) {
+            printke("taking a range containing used block %d", block);
+            abort();
+        }
+
+        uint32_t head_end = head + NTHBIT(order);
+
+        buddy_remove(head, order);
+        used_blocks += NTHBIT(order);
+
+        // Give back what lies outside of the range
+        if (head < block) {
+            buddy_free_range(head, block - head);
+        }
+
+        if (head_end > end) {
+            buddy_free_range(end, head_end - end);
+            head_end = end;
+        }
+
+        block = head_end;
+    }
 }
 
-/* Returns the first block of frame_size bits
+/* Returns the first block of a run of `num` free pages, `NO_BLOCK` if there
+ * are none. Free blocks are skipped whole, so this is linear in the number of
+ * used pages, not in the amount of memory.
  */
-uint32_t mmap_find_free_frame(uint32_t frame_size) {
-    uint32_t first = 0;
-    uint32_t count = 0;
-
-    for (uint32_t i = 0; i < max_blocks/32; i++) {
-        if (bitmap[i] != 0xFFFFFFFF) {
-            for (uint32_t j = 0; j < 32; j++) {
-                if (!(bitmap[i] & NTHBIT(j))) {
-                    if (!first) {
-                        first = i*32+j;
-                    }
-
-                    count++;
-                } else {
-                    first = 0;
-                    count = 0;
-                }
-
-                if (count == frame_size) {
-                    return first;
-                }
+static uint32_t buddy_find_free_run(uint32_t num) {
+    uint32_t first = NO_BLOCK;
+    uint32_t block = 1;
+
+    while (block < top_block) {
+        if (orders[block] & ORDER_FREE) {
+            if (!first) {
+                first = block;
+            }
+
+            block += NTHBIT(orders[block] & ~ORDER_FREE);
+
+            if (block - first >= num) {
+                return first;
             }
         } else {
-            first = 0;
-            count = 0;
+            first = NO_BLOCK;
+            block++;
         }
     }
 
-    return 0;
+    return NO_BLOCK;
 }
 
-/* Returns the first address after the kernel in physical memory.
+/* Returns the smallest order whose blocks can hold `num` pages.
  */
-uintptr_t pmm_get_kernel_end() {
-    return (uintptr_t) kernel_end + max_blocks / 8;
-}
\ No newline at end of file
+static uint32_t buddy_order(uint32_t num) {
+    if (num <= 1) {
+        return 0;
+    }
+
+    return 32 - __builtin_clz(num - 1);
+}
+
+/* Checks that the given pages are in the opposite state in the bitmap, then
+ * updates it. Does nothing unless `PMM_DEBUG` is defined.
+ */
+static void pmm_debug_mark(uint32_t block, uint32_t num, bool used) {
+#ifdef PMM_DEBUG
+    for (uint32_t i = block; i < block + num; i++) {
+        bool was_used = mmap_test(i);
+
+        if (was_used == used) {
+            printke("block %d %s", i, used ? "allocated twice" : "freed twice");
+            abort();
+        }
+
+        if (used) {
+            mmap_set(i);
+        } else {
+            mmap_unset(i);
+        }
+    }
+#else
+    UNUSED(block);
+    UNUSED(num);
+    UNUSED(used);
+#endif
+}
@@ -100,12 +100,6 @@ typedef struct {
     uint32_t os_specific2[3];
 } ext2_inode_t;
 
-typedef struct dentry_t {
-    char* name;
-    uint32_t inode;
-    uint32_t type;
-} dentry_t;
-
 typedef struct {
     uint32_t inode;
     uint16_t entry_size;
@@ -114,14 +108,68 @@ typedef struct {
     char name[];
 } ext2_directory_entry_t;
 
+/* Number of hash buckets of the inode cache, number of unused inodes it keeps
+ * around, and number of dirty inodes after which they're written back.
+ */
+#define ICACHE_BUCKETS 128
+#define ICACHE_MAX_IDLE 256
+#define ICACHE_DIRTY_BATCH 32
+
+/* Number of blocks reserved for an inode past the one it asked for, so that
+ * files written a bit at a time stay contiguous.
+ */
+#define PREALLOC_BLOCKS 8
+
+/* An inode cached in memory. Handles returned by `get_inode` point to `in`,
+ * which comes first, and are released with `put_inode`. Unused inodes sit in
+ * the LRU list until evicted, modified ones in the dirty list until written
+ * back by `flush_inodes`.
+ * `block_map` translates logical block numbers to physical ones without going
+ * through indirect blocks. It's built on first use, see `get_inode_block`.
+ * `prealloc_block` and the `prealloc_count` blocks after it are reserved for
+ * the inode's next blocks, see `allocate_inode_block`.
+ */
+typedef struct ext2_cached_inode_t {
+    ext2_inode_t in;
+    uint32_t ino;
+    uint32_t refcount;
+    bool dirty;
+    struct ext2_cached_inode_t* next;
+    struct ext2_cached_inode_t* next_dirty;
+    list_t lru;
+    uint32_t* block_map;
+    uint32_t block_map_len;
+    uint32_t block_map_cap;
+    uint32_t last_block; // Last block allocated to the inode, or zero
+    uint32_t prealloc_block;
+    uint32_t prealloc_count;
+} ext2_cached_inode_t;
+
+/* In-memory state of a block group. Its bitmaps are loaded on first use, and
+ * `dirty` is set when they or its descriptor changed since the last sync.
+ */
+typedef struct {
+    uint8_t* block_bitmap;
+    uint8_t* inode_bitmap;
+    bool dirty;
+} ext2_group_t;
+
 typedef struct ext2_fs_t {
     fs_t fs;
     superblock_t* sb;
     group_descriptor_t* group_descriptors;
+    ext2_group_t* groups;
+    bool sb_dirty;
     uint8_t* device;
     uint32_t block_size;
     uint32_t inode_size;
     uint32_t num_block_groups;
+    kmem_cache_t* inode_cache;
+    ext2_cached_inode_t* icache[ICACHE_BUCKETS];
+    list_t icache_lru; // Unused inodes, least recently used first
+    uint32_t icache_idle;
+    ext2_cached_inode_t* icache_dirty;
+    uint32_t icache_dirty_count;
 } ext2_fs_t;
 
 #define INODE_FIFO 0x1000
@@ -146,6 +194,11 @@ typedef struct ext2_fs_t {
 #define PERM_SETGID 0x400
 #define PERM_SETUID 0x800
 
+/* Set on directories indexed with a hash tree. We don't maintain the index,
+ * so we clear it when changing such directories, as the format expects.
+ */
+#define INODE_FLAG_INDEX 0x1000
+
 #define INODE_TYPE(n) (n & 0xF000)
 #define INODE_PERM(n) (n & 0xFFF)
 
@@ -159,37 +212,63 @@ int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t dest
 uint32_t ext2_mkdir(ext2_fs_t* fs, const char* name, uint32_t parent_inode);
 uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t size);
 uint32_t ext2_append(ext2_fs_t* fs, uint32_t inode, uint8_t* data, uint32_t size);
+uint32_t ext2_write_at(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* data, uint32_t size);
+int32_t ext2_truncate(ext2_fs_t* fs, uint32_t inode, uint32_t size);
 sos_directory_entry_t* ext2_readdir(ext2_fs_t* fs, uint32_t inode, uint32_t offset);
 inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode);
 int32_t ext2_close(ext2_fs_t* fs, uint32_t ino);
 int32_t ext2_stat(ext2_fs_t* fs, uint32_t ino, stat_t* stat);
+int32_t ext2_sync(ext2_fs_t* fs);
 
 static void read_block(ext2_fs_t* fs, uint32_t block, uint8_t* buf);
+static void read_blocks(ext2_fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf);
 static void write_block(ext2_fs_t* fs, uint32_t block, uint8_t* buf);
+static void read_block_part(ext2_fs_t* fs, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t size);
+static void write_block_part(ext2_fs_t* fs, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t size);
 static void clear_block(ext2_fs_t* fs, uint32_t block);
-static void write_superblock(ext2_fs_t* fs);
-static void write_group_descriptor(ext2_fs_t* fs, uint32_t group);
+static uint8_t* get_block_bitmap(ext2_fs_t* fs, uint32_t group);
+static uint8_t* get_inode_bitmap(ext2_fs_t* fs, uint32_t group);
+static void mark_group_dirty(ext2_fs_t* fs, uint32_t group);
 static superblock_t* parse_superblock(ext2_fs_t* fs);
 static group_descriptor_t* parse_group_descriptors(ext2_fs_t* fs);
 static void read_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf);
+static uint32_t read_inode_run(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t max, uint8_t* buf);
 static void write_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint8_t* buf);
+static void inode_location(ext2_fs_t* fs, uint32_t ino, uint32_t* block, uint32_t* offset);
 static ext2_inode_t* get_inode(ext2_fs_t* fs, uint32_t inode);
-static uint32_t allocate_block(ext2_fs_t* fs);
+static void put_inode(ext2_fs_t* fs, ext2_inode_t* in);
+static void evict_inode(ext2_fs_t* fs, ext2_cached_inode_t* ci);
+static void flush_inodes(ext2_fs_t* fs);
+static uint32_t bsf(uint32_t word);
+static uint32_t find_clear_bit(uint8_t* bitmap, uint32_t start, uint32_t end);
+static uint32_t group_blocks(ext2_fs_t* fs, uint32_t group);
+static uint32_t allocate_blocks(ext2_fs_t* fs, uint32_t goal, uint32_t max, uint32_t* count);
+static uint32_t allocate_inode_block(ext2_fs_t* fs, ext2_cached_inode_t* ci);
+static void discard_prealloc(ext2_fs_t* fs, ext2_cached_inode_t* ci);
 static void free_block(ext2_fs_t* fs, uint32_t block);
-static uint32_t allocate_inode(ext2_fs_t* fs);
+static uint32_t allocate_inode(ext2_fs_t* fs, uint32_t goal_group);
 static void free_inode(ext2_fs_t* fs, uint32_t ino);
 static uint32_t min_dir_entry_size(const char* name);
-static void update_inode(ext2_fs_t* fs, uint32_t ino, ext2_inode_t* in);
+static void mark_inode_dirty(ext2_fs_t* fs, ext2_inode_t* in);
 static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint32_t n);
 static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n);
+static uint32_t walk_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n);
+static uint32_t read_block_pointer(ext2_fs_t* fs, uint32_t block, uint32_t index, uint32_t* tmp);
+static void build_block_map(ext2_fs_t* fs, ext2_cached_inode_t* ci);
+static uint32_t map_indirect_block(ext2_fs_t* fs, uint32_t block, uint32_t depth, uint32_t* map, uint32_t count);
+static void block_map_set(ext2_cached_inode_t* ci, uint32_t n, uint32_t block);
+static void free_block_map(ext2_cached_inode_t* ci);
+static void truncate_blocks(ext2_fs_t* fs, ext2_inode_t* in, uint32_t first);
+static bool truncate_indirect_block(ext2_fs_t* fs, uint32_t block, uint32_t depth, uint32_t from);
 static uint32_t add_directory_entry(ext2_fs_t* fs, const char* name, uint32_t d_ino, uint32_t type);
-static list_t* directory_to_entries(ext2_fs_t* fs, uint32_t ino);
-static void write_directory_entries(ext2_fs_t* fs, uint32_t ino, list_t* dir_entries);
-static dentry_t* make_directory_entry(const char* name, uint32_t ino, uint32_t type);
-static void free_directory_entries(list_t* entries);
+static void fill_directory_entry(ext2_directory_entry_t* ent, const char* name, uint32_t ino, uint32_t type);
+static bool insert_directory_entry(ext2_fs_t* fs, ext2_inode_t* d_in, const char* name, uint32_t ino, uint32_t type);
+static bool remove_directory_entry(ext2_fs_t* fs, ext2_inode_t* d_in, uint32_t ino, char* name, uint32_t* type);
+static void drop_directory_index(ext2_fs_t* fs, ext2_inode_t* d_in);
+static void set_parent_entry(ext2_fs_t* fs, ext2_inode_t* d_in, uint32_t parent_ino);
 
 fs_t* init_ext2(uint8_t* data, uint32_t len) {
-    ext2_fs_t* e2fs = kmalloc(sizeof(ext2_fs_t));
+    ext2_fs_t* e2fs = zalloc(sizeof(ext2_fs_t));
 
     if (len < 1024 + sizeof(superblock_t)) {
         printke("invalid volume: too small to be true");
@@ -198,14 +277,21 @@ fs_t* init_ext2(uint8_t* data, uint32_t len) {
 
     e2fs->device = data;
     e2fs->sb = parse_superblock(e2fs);
-    e2fs->group_descriptors = parse_group_descriptors(e2fs);
 
     if (!e2fs->sb) {
         printke("bad superblock, aborting");
         return NULL;
     }
 
+    e2fs->group_descriptors = parse_group_descriptors(e2fs);
+    e2fs->groups = zalloc(e2fs->num_block_groups*sizeof(ext2_group_t));
+
+    e2fs->inode_cache = kmem_cache_create("ext2_cached_inode_t", sizeof(ext2_cached_inode_t), 0);
+    e2fs->icache_lru = LIST_HEAD_INIT(e2fs->icache_lru);
+
     e2fs->fs.append = (fs_append_t) ext2_append;
+    e2fs->fs.write_at = (fs_write_at_t) ext2_write_at;
+    e2fs->fs.truncate = (fs_truncate_t) ext2_truncate;
     e2fs->fs.create = (fs_create_t) ext2_create;
     e2fs->fs.rename = (fs_rename_t) ext2_rename;
     e2fs->fs.get_fs_inode = (fs_get_fs_inode_t) ext2_get_fs_inode;
@@ -214,6 +300,7 @@ fs_t* init_ext2(uint8_t* data, uint32_t len) {
     e2fs->fs.unlink = (fs_unlink_t) ext2_unlink;
     e2fs->fs.close = (fs_close_t) ext2_close;
     e2fs->fs.stat = (fs_stat_t) ext2_stat;
+    e2fs->fs.sync = (fs_sync_t) ext2_sync;
 
     e2fs->fs.uid = e2fs->sb->id[0];
     e2fs->fs.root = (folder_inode_t*) ext2_get_fs_inode(e2fs, EXT2_ROOT_INODE);
@@ -232,122 +319,177 @@ uint32_t ext2_create(ext2_fs_t* fs, const char* name, uint32_t type, uint32_t pa
  * if it is no longer referenced anywhere.
  */
 int32_t ext2_unlink(ext2_fs_t* fs, uint32_t d_ino, uint32_t ino) {
+    ext2_inode_t* d_in = get_inode(fs, d_ino);
     ext2_inode_t* in = get_inode(fs, ino);
 
-    list_t* entries = directory_to_entries(fs, d_ino);
-    list_t* iter;
-    dentry_t* ent;
-
-    list_for_each(iter, ent, entries) {
-        if (ent->inode == ino) {
-            kfree(ent->name);
-            kfree(ent);
-            list_del(iter);
-            break;
-        }
+    if (!d_in || !in || !remove_directory_entry(fs, d_in, ino, NULL, NULL)) {
+        put_inode(fs, in);
+        put_inode(fs, d_in);
+        return -1;
     }
 
-    write_directory_entries(fs, d_ino, entries);
-
     if (--in->hardlinks_count == 0) {
         free_inode(fs, ino);
-    } else {
-        update_inode(fs, ino, in);
     }
 
+    mark_inode_dirty(fs, in);
+    put_inode(fs, in);
+    put_inode(fs, d_in);
+
     return 0;
 }
 
 /* Move `ino` whose parent directory is `dir_ino`, to the directory `destdir_ino`.
+ * A directory's ".." entry follows it, along with the link it accounts for.
  */
 int32_t ext2_rename(ext2_fs_t* fs, uint32_t dir_ino, uint32_t ino, uint32_t destdir_ino) {
-    list_t* entries = directory_to_entries(fs, dir_ino);
-    list_t* iter;
-    dentry_t* ent;
-
-    if (!entries) {
-        return -1;
+    if (dir_ino == destdir_ino) {
+        return 0;
     }
 
-    /* Look for the file to move, remove it from the list */
-    list_for_each(iter, ent, entries) {
-        if (ent->inode == ino) {
-            list_del(iter);
-            break;
+    ext2_inode_t* dir = get_inode(fs, dir_ino);
+    ext2_inode_t* destdir = get_inode(fs, destdir_ino);
+    char name[MAX_PATH];
+    uint32_t type;
+    int32_t ret = -1;
+
+    if (dir && destdir && remove_directory_entry(fs, dir, ino, name, &type)) {
+        if (insert_directory_entry(fs, destdir, name, ino, type)) {
+            ext2_inode_t* in = get_inode(fs, ino);
+
+            if (in && INODE_TYPE(in->type_perms) == INODE_DIR) {
+                set_parent_entry(fs, in, destdir_ino);
+                dir->hardlinks_count--;
+                destdir->hardlinks_count++;
+                mark_inode_dirty(fs, dir);
+                mark_inode_dirty(fs, destdir);
+            }
+
+            put_inode(fs, in);
+            ret = 0;
+        } else {
+            // Put it back where it was
+            insert_directory_entry(fs, dir, name, ino, type);
         }
     }
 
-    /* Not found */
-    if (iter == entries) {
-        free_directory_entries(entries);
-        kfree(entries);
-
-        return -1;
-    }
+    put_inode(fs, destdir);
+    put_inode(fs, dir);
 
-    /* Update the destination dir's list */
-    list_t* new_entries = directory_to_entries(fs, destdir_ino);
+    return ret;
+}
 
-    if (!new_entries) {
-        free_directory_entries(entries);
-        kfree(entries);
+/* Appends `size` bytes from `data` to the file pointed to by `inode`.
+ * Returns the number of bytes written.
+ */
+uint32_t ext2_append(ext2_fs_t* fs, uint32_t inode, uint8_t* data, uint32_t size) {
+    ext2_inode_t* in = get_inode(fs, inode);
 
-        return -1;
+    if (!in) {
+        return 0;
     }
 
-    list_add(new_entries, make_directory_entry(ent->name, ent->inode, ent->type));
-
-    /* Write changes to disk */
-    write_directory_entries(fs, destdir_ino, new_entries);
-    write_directory_entries(fs, dir_ino, entries);
+    uint32_t written = ext2_write_at(fs, inode, in->size_lower, data, size);
+    put_inode(fs, in);
 
-    free_directory_entries(entries);
-    kfree(entries);
-    free_directory_entries(new_entries);
-    kfree(new_entries);
-
-    return 0;
+    return written;
 }
 
-/* Appends `size` bytes from `data` to the file pointed to by `inode`.
+/* Writes `size` bytes from `data` at `offset` in the file `inode`, reusing the
+ * blocks already there and allocating the others. Writing past the end of the
+ * file extends it, leaving a hole if `offset` is past its end.
  * Returns the number of bytes written.
  */
-uint32_t ext2_append(ext2_fs_t* fs, uint32_t inode, uint8_t* data, uint32_t size) {
+uint32_t ext2_write_at(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* data, uint32_t size) {
     ext2_inode_t* in = get_inode(fs, inode);
-    uint8_t* tmp = zalloc(fs->block_size);
 
-    uint32_t start_block = in->size_lower / fs->block_size;
-    uint32_t end_block = (in->size_lower + size) / fs->block_size;
-    uint32_t offset_start = in->size_lower % fs->block_size;
-    uint32_t offset_end = (in->size_lower + size) % fs->block_size;
+    if (!in || !size) {
+        put_inode(fs, in);
+        return 0;
+    }
 
-    if (start_block == end_block) {
-        read_inode_block(fs, in, start_block, tmp);
-        memcpy(tmp + offset_start, data, size);
-        write_inode_block(fs, in, start_block, tmp);
-    } else {
-        for (uint32_t block = start_block; block < end_block; block++) {
-            if (block == start_block) {
-                read_inode_block(fs, in, start_block, tmp);
-                memcpy(tmp + offset_start, data, fs->block_size - offset_start);
-                write_inode_block(fs, in, start_block, tmp);
+    uint8_t* tmp = kmalloc(fs->block_size);
+    uint32_t end = offset + size;
+    uint32_t written = 0;
+
+    while (offset + written < end) {
+        uint32_t pos = offset + written;
+        uint32_t block_no = pos / fs->block_size;
+        uint32_t block_offset = pos % fs->block_size;
+        uint32_t chunk = fs->block_size - block_offset;
+
+        if (chunk > end - pos) {
+            chunk = end - pos;
+        }
+
+        bool fresh = !get_inode_block(fs, in, block_no);
+        uint32_t block = get_or_create_inode_block(fs, in, block_no);
+
+        if (!block) {
+            break;
+        }
+
+        // Only partially overwritten blocks need to be read first, new ones
+        // may hold data from deleted files
+        if (chunk == fs->block_size) {
+            write_block(fs, block, data + written);
+        } else {
+            if (fresh) {
+                memset(tmp, 0, fs->block_size);
             } else {
-                write_inode_block(fs, in, block, data + (block - start_block)*fs->block_size);
+                read_block(fs, block, tmp);
             }
-        }
 
-        if (offset_end) {
-            memcpy(tmp, data + (end_block - start_block)*fs->block_size - offset_start, offset_end);
-            write_inode_block(fs, in, end_block, tmp);
+            memcpy(tmp + block_offset, data + written, chunk);
+            write_block(fs, block, tmp);
         }
+
+        written += chunk;
     }
 
-    in->size_lower += size;
-    update_inode(fs, inode, in);
+    if (offset + written > in->size_lower) {
+        in->size_lower = offset + written;
+    }
+
+    mark_inode_dirty(fs, in);
     kfree(tmp);
-    kfree(in);
+    put_inode(fs, in);
+
+    return written;
+}
+
+/* Sets the size of the file `inode` to `size` bytes. Blocks past the new end
+ * are freed; growing the file leaves a hole that reads as zeros.
+ */
+int32_t ext2_truncate(ext2_fs_t* fs, uint32_t inode, uint32_t size) {
+    ext2_inode_t* in = get_inode(fs, inode);
+
+    if (!in || INODE_TYPE(in->type_perms) != INODE_FILE) {
+        put_inode(fs, in);
+        return -1;
+    }
+
+    if (size < in->size_lower) {
+        truncate_blocks(fs, in, divide_up(size, fs->block_size));
+
+        // Clear the end of the last block, it would be read back if we grew
+        uint32_t tail = size % fs->block_size;
+        uint32_t block = get_inode_block(fs, in, size / fs->block_size);
+
+        if (tail && block) {
+            uint8_t* tmp = kmalloc(fs->block_size);
+            read_block(fs, block, tmp);
+            memset(tmp + tail, 0, fs->block_size - tail);
+            write_block(fs, block, tmp);
+            kfree(tmp);
+        }
+    }
 
-    return size;
+    in->size_lower = size;
+    mark_inode_dirty(fs, in);
+    put_inode(fs, in);
+
+    return 0;
 }
 
 /* Reads at most `size` bytes from `inode`, and returns the number of bytes read.
@@ -365,7 +507,7 @@ uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf,
     uint32_t end;
 
     if (!size || !fsize || offset >= fsize) {
-        kfree(in);
+        put_inode(fs, in);
         return 0;
     }
 
@@ -387,14 +529,15 @@ uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf,
         read_inode_block(fs, in, start_block, tmp);
         memcpy(buf, tmp + start_offset, bytes_read);
     } else {
-        for (uint32_t block_no = start_block; block_no < end_block; block_no++) {
-            if (block_no == start_block) {
-                read_inode_block(fs, in, start_block, tmp);
-                memcpy(buf, tmp + start_offset, fs->block_size - start_offset);
-            } else {
-                read_inode_block(fs, in, block_no,
-                    buf + (block_no - start_block)*fs->block_size - start_offset);
-            }
+        read_inode_block(fs, in, start_block, tmp);
+        memcpy(buf, tmp + start_offset, fs->block_size - start_offset);
+
+        // Copy whole blocks directly, a contiguous run at a time
+        uint32_t block_no = start_block + 1;
+
+        while (block_no < end_block) {
+            block_no += read_inode_run(fs, in, block_no, end_block - block_no,
+                buf + (block_no - start_block)*fs->block_size - start_offset);
         }
 
         if (end_offset) {
@@ -403,7 +546,7 @@ uint32_t ext2_read(ext2_fs_t* fs, uint32_t inode, uint32_t offset, uint8_t* buf,
         }
     }
 
-    kfree(in);
+    put_inode(fs, in);
     kfree(tmp);
 
     return bytes_read;
@@ -423,14 +566,30 @@ sos_directory_entry_t* ext2_readdir(ext2_fs_t* fs, uint32_t inode, uint32_t offs
         return NULL;
     }
 
+    // Skip unused records, such as those left at the start of blocks by
+    // `remove_directory_entry`
+    uint32_t skipped = 0;
+
+    while (!ent.inode && ent.entry_size) {
+        skipped += ent.entry_size;
+        read = ext2_read(fs, inode, offset + skipped, (uint8_t*) &ent, sizeof(ext2_directory_entry_t));
+
+        if (!read) {
+            return NULL;
+        }
+    }
+
     ext2_directory_entry_t* entry = kmalloc(ent.entry_size);
-    read = ext2_read(fs, inode, offset, (uint8_t*) entry, ent.entry_size);
+    read = ext2_read(fs, inode, offset + skipped, (uint8_t*) entry, ent.entry_size);
 
     if (!read) {
         kfree(entry);
         return NULL;
     }
 
+    // Have the caller skip the unused records too
+    entry->entry_size += skipped;
+
     // This is fine in the specific case of ext2, but not great
     return (sos_directory_entry_t*) entry;
 }
@@ -439,6 +598,10 @@ inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode) {
     ext2_inode_t* in = get_inode(fs, inode);
     inode_t* fs_in = NULL;
 
+    if (!in) {
+        return NULL;
+    }
+
     if (INODE_TYPE(in->type_perms) == INODE_FILE) {
         file_inode_t* fi = kmalloc(sizeof(file_inode_t));
         fi->ino.type = DTYPE_FILE;
@@ -448,10 +611,12 @@ inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode) {
         fi->dirty = true;
         fi->subfiles = LIST_HEAD_INIT(fi->subfiles);
         fi->subfolders = LIST_HEAD_INIT(fi->subfolders);
+        fi->version = 0;
         fi->ino.type = DENT_DIRECTORY;
         fs_in = (inode_t*) fi;
     } else {
         printke("unsupported inode type: %X", INODE_TYPE(in->type_perms));
+        put_inode(fs, in);
         return NULL;
     }
 
@@ -460,14 +625,23 @@ inode_t* ext2_get_fs_inode(ext2_fs_t* fs, uint32_t inode) {
     fs_in->hardlinks = in->hardlinks_count;
     fs_in->fs = (fs_t*) fs;
 
-    kfree(in);
+    put_inode(fs, in);
 
     return fs_in;
 }
 
+/* Gives back the blocks preallocated for the inode, if it's still cached.
+ */
 int32_t ext2_close(ext2_fs_t* fs, uint32_t ino) {
-    UNUSED(fs);
-    UNUSED(ino);
+    ext2_cached_inode_t* ci = fs->icache[ino % ICACHE_BUCKETS];
+
+    while (ci && ci->ino != ino) {
+        ci = ci->next;
+    }
+
+    if (ci) {
+        discard_prealloc(fs, ci);
+    }
 
     return 0;
 }
@@ -485,6 +659,56 @@ int32_t ext2_stat(ext2_fs_t* fs, uint32_t ino, stat_t* stat) {
     stat->st_nlink = in->hardlinks_count;
     stat->st_size = in->size_lower;
 
+    put_inode(fs, in);
+
+    return 0;
+}
+
+/* Writes back the metadata kept in memory: dirty inodes, bitmaps, group
+ * descriptors and the superblock.
+ */
+int32_t ext2_sync(ext2_fs_t* fs) {
+    bool groups_dirty = false;
+
+    // Reservations aren't worth persisting
+    for (uint32_t i = 0; i < ICACHE_BUCKETS; i++) {
+        for (ext2_cached_inode_t* ci = fs->icache[i]; ci; ci = ci->next) {
+            discard_prealloc(fs, ci);
+        }
+    }
+
+    flush_inodes(fs);
+
+    for (uint32_t i = 0; i < fs->num_block_groups; i++) {
+        ext2_group_t* group = &fs->groups[i];
+
+        if (!group->dirty) {
+            continue;
+        }
+
+        if (group->block_bitmap) {
+            write_block(fs, fs->group_descriptors[i].block_bitmap, group->block_bitmap);
+        }
+
+        if (group->inode_bitmap) {
+            write_block(fs, fs->group_descriptors[i].inode_bitmap, group->inode_bitmap);
+        }
+
+        group->dirty = false;
+        groups_dirty = true;
+    }
+
+    if (groups_dirty) {
+        write_block_part(fs, fs->sb->superblock_block + 1, 0, (uint8_t*) fs->group_descriptors,
+            fs->num_block_groups*sizeof(group_descriptor_t));
+    }
+
+    // The superblock is always 1024 bytes into the volume
+    if (fs->sb_dirty) {
+        write_block_part(fs, 0, 1024, (uint8_t*) fs->sb, 1024);
+        fs->sb_dirty = false;
+    }
+
     return 0;
 }
 
@@ -497,20 +721,57 @@ static void read_block(ext2_fs_t* fs, uint32_t block, uint8_t* buf) {
     memcpy(buf, fs->device + block*fs->block_size, fs->block_size);
 }
 
+/* Reads `count` consecutive blocks starting at `block`.
+ */
+static void read_blocks(ext2_fs_t* fs, uint32_t block, uint32_t count, uint8_t* buf) {
+    memcpy(buf, fs->device + block*fs->block_size, count*fs->block_size);
+}
+
 static void write_block(ext2_fs_t* fs, uint32_t block, uint8_t* buf) {
     memcpy(fs->device + block*fs->block_size, buf, fs->block_size);
 }
 
+/* Reads `size` bytes at `offset` in the given block.
+ */
+static void read_block_part(ext2_fs_t* fs, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t size) {
+    memcpy(buf, fs->device + block*fs->block_size + offset, size);
+}
+
+static void write_block_part(ext2_fs_t* fs, uint32_t block, uint32_t offset, uint8_t* buf, uint32_t size) {
+    memcpy(fs->device + block*fs->block_size + offset, buf, size);
+}
+
 static void clear_block(ext2_fs_t* fs, uint32_t block) {
     memset(fs->device + block*fs->block_size, 0, fs->block_size);
 }
 
-static void write_superblock(ext2_fs_t* fs) {
-    write_block(fs, 1, (uint8_t*) fs->sb);
+/* Returns the block bitmap of the given group, reading it on first use.
+ * Bitmaps always fit in a block.
+ */
+static uint8_t* get_block_bitmap(ext2_fs_t* fs, uint32_t group) {
+    if (!fs->groups[group].block_bitmap) {
+        fs->groups[group].block_bitmap = kmalloc(fs->block_size);
+        read_block(fs, fs->group_descriptors[group].block_bitmap, fs->groups[group].block_bitmap);
+    }
+
+    return fs->groups[group].block_bitmap;
 }
 
-static void write_group_descriptor(ext2_fs_t* fs, uint32_t group) {
-    write_block(fs, 2, (uint8_t*) &fs->group_descriptors[group]);
+static uint8_t* get_inode_bitmap(ext2_fs_t* fs, uint32_t group) {
+    if (!fs->groups[group].inode_bitmap) {
+        fs->groups[group].inode_bitmap = kmalloc(fs->block_size);
+        read_block(fs, fs->group_descriptors[group].inode_bitmap, fs->groups[group].inode_bitmap);
+    }
+
+    return fs->groups[group].inode_bitmap;
+}
+
+/* Records that the bitmaps or the descriptor of a group changed, and with them
+ * the free counts of the superblock. They're written back by `ext2_sync`.
+ */
+static void mark_group_dirty(ext2_fs_t* fs, uint32_t group) {
+    fs->groups[group].dirty = true;
+    fs->sb_dirty = true;
 }
 
 /* Parses an ext2 superblock from the ext2 partition buffer stored at `data`.
@@ -536,16 +797,13 @@ static superblock_t* parse_superblock(ext2_fs_t* fs) {
 }
 
 /* Returns a kmalloc'ed array of `num_block_groups` block group descriptors.
+ * They're in the block following the superblock.
  */
 static group_descriptor_t* parse_group_descriptors(ext2_fs_t* fs) {
-    uint8_t* block = kmalloc(fs->block_size);
-    read_block(fs, 2, block);
-
     uint32_t size = fs->num_block_groups * sizeof(group_descriptor_t);
     group_descriptor_t* bgd = kmalloc(size);
 
-    memcpy((void*) bgd, (void*) block, size);
-    kfree(block);
+    read_block_part(fs, fs->sb->superblock_block + 1, 0, (uint8_t*) bgd, size);
 
     return bgd;
 }
@@ -565,6 +823,28 @@ static void read_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uin
     }
 }
 
+/* Reads the blocks of the inode from the `n`-th on that are physically
+ * contiguous, up to `max` of them, in one go.
+ * Returns the number of blocks read, at least one.
+ */
+static uint32_t read_inode_run(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, uint32_t max, uint8_t* buf) {
+    uint32_t first = get_inode_block(fs, inode, n);
+    uint32_t count = 1;
+
+    if (!first) {
+        memset(buf, 0, fs->block_size);
+        return 1;
+    }
+
+    while (count < max && get_inode_block(fs, inode, n + count) == first + count) {
+        count++;
+    }
+
+    read_blocks(fs, first, count, buf);
+
+    return count;
+}
+
 /* Writes to the `n`-th block of the given inode.
  * If the block didn't exist, it is created.
  */
@@ -574,74 +854,238 @@ static void write_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n, ui
     write_block(fs, block, buf);
 }
 
-/* Returns an inode struct from an inode number.
- * This inode can be freed using `kfree`.
- * Note: doesn't check that the inode is valid.
+/* Computes the block of the inode table holding the inode `ino`, and the
+ * offset of the inode in that block.
+ */
+static void inode_location(ext2_fs_t* fs, uint32_t ino, uint32_t* block, uint32_t* offset) {
+    uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
+    uint32_t index = (ino - 1) % fs->sb->inodes_per_group;
+
+    *block = fs->group_descriptors[group].inode_table + (index * fs->inode_size) / fs->block_size;
+    *offset = (index * fs->inode_size) % fs->block_size;
+}
+
+/* Returns a handle to the inode `inode`, reading it from disk only if it isn't
+ * cached. The handle must be released with `put_inode`, and stays valid until
+ * then; changes to it must be signaled with `mark_inode_dirty`.
+ * Note: doesn't check that the inode is in use.
  */
 static ext2_inode_t* get_inode(ext2_fs_t* fs, uint32_t inode) {
-    if (inode == 0) {
+    if (inode == 0 || inode > fs->sb->inodes_count) {
         return NULL;
     }
 
-    // which block group is our inode in?
-    uint32_t group = (inode - 1) / fs->sb->inodes_per_group;
+    ext2_cached_inode_t** bucket = &fs->icache[inode % ICACHE_BUCKETS];
+    ext2_cached_inode_t* ci = *bucket;
 
-    // get the location of the inode table from the group block's descriptor
-    uint32_t table_block = fs->group_descriptors[group].inode_table;
-    uint32_t block_offset = ((inode - 1) * fs->inode_size) / fs->block_size;
-    uint32_t index_in_block = (inode - 1) - block_offset * (fs->block_size / fs->inode_size);
+    while (ci && ci->ino != inode) {
+        ci = ci->next;
+    }
 
-    uint8_t* tmp = kmalloc(fs->block_size);
-    read_block(fs, table_block + block_offset, tmp);
-    ext2_inode_t* in = kmalloc(fs->inode_size);
-    memcpy(in, tmp + index_in_block*fs->inode_size, fs->inode_size);
-    kfree(tmp);
+    if (ci) {
+        if (ci->refcount++ == 0) {
+            __list_del(ci->lru.prev, ci->lru.next);
+            fs->icache_idle--;
+        }
 
-    return in;
+        return &ci->in;
+    }
+
+    uint32_t block, offset;
+    inode_location(fs, inode, &block, &offset);
+
+    ci = kmem_cache_alloc(fs->inode_cache);
+    read_block_part(fs, block, offset, (uint8_t*) &ci->in, sizeof(ext2_inode_t));
+    ci->ino = inode;
+    ci->refcount = 1;
+    ci->dirty = false;
+    ci->next_dirty = NULL;
+    ci->block_map = NULL;
+    ci->last_block = 0;
+    ci->prealloc_count = 0;
+    ci->lru.data = ci;
+    ci->next = *bucket;
+    *bucket = ci;
+
+    return &ci->in;
+}
+
+/* Releases a handle obtained from `get_inode`. Unused inodes stay cached until
+ * too many of them are, in which case the least recently used one goes.
+ */
+static void put_inode(ext2_fs_t* fs, ext2_inode_t* in) {
+    ext2_cached_inode_t* ci = (ext2_cached_inode_t*) in;
+
+    if (!in || --ci->refcount) {
+        return;
+    }
+
+    __list_add(&ci->lru, fs->icache_lru.prev, &fs->icache_lru);
+    fs->icache_idle++;
+
+    if (fs->icache_idle > ICACHE_MAX_IDLE) {
+        evict_inode(fs, list_first_entry(&fs->icache_lru, ext2_cached_inode_t));
+    }
+}
+
+/* Drops an unused inode from the cache, writing dirty inodes back first.
+ */
+static void evict_inode(ext2_fs_t* fs, ext2_cached_inode_t* ci) {
+    discard_prealloc(fs, ci);
+
+    if (ci->dirty) {
+        flush_inodes(fs);
+    }
+
+    ext2_cached_inode_t** link = &fs->icache[ci->ino % ICACHE_BUCKETS];
+
+    while (*link != ci) {
+        link = &(*link)->next;
+    }
+
+    *link = ci->next;
+    __list_del(ci->lru.prev, ci->lru.next);
+    fs->icache_idle--;
+
+    free_block_map(ci);
+    kmem_cache_free(fs->inode_cache, ci);
+}
+
+/* Records that the inode behind the handle `in` was modified. Modified inodes
+ * are written back together once there are enough of them.
+ */
+static void mark_inode_dirty(ext2_fs_t* fs, ext2_inode_t* in) {
+    ext2_cached_inode_t* ci = (ext2_cached_inode_t*) in;
+
+    if (ci->dirty) {
+        return;
+    }
+
+    ci->dirty = true;
+    ci->next_dirty = fs->icache_dirty;
+    fs->icache_dirty = ci;
+
+    if (++fs->icache_dirty_count >= ICACHE_DIRTY_BATCH) {
+        flush_inodes(fs);
+    }
+}
+
+/* Writes every dirty inode back to its inode table.
+ * Only the fields we know of are written, the rest of larger on-disk inodes is
+ * left untouched.
+ */
+static void flush_inodes(ext2_fs_t* fs) {
+    while (fs->icache_dirty) {
+        ext2_cached_inode_t* ci = fs->icache_dirty;
+        uint32_t block, offset;
+
+        inode_location(fs, ci->ino, &block, &offset);
+        write_block_part(fs, block, offset, (uint8_t*) &ci->in, sizeof(ext2_inode_t));
+
+        fs->icache_dirty = ci->next_dirty;
+        ci->next_dirty = NULL;
+        ci->dirty = false;
+    }
+
+    fs->icache_dirty_count = 0;
 }
 
-/* Returns a free block number, marking it as used.
+/* Returns the index of the lowest set bit of a non-zero word.
  */
-static uint32_t allocate_block(ext2_fs_t* fs) {
-    /* Exit early */
+static inline uint32_t bsf(uint32_t word) {
+    uint32_t index;
+    asm("bsf %1, %0" : "=r"(index) : "rm"(word));
+
+    return index;
+}
+
+/* Returns the index of the first clear bit of `bitmap` in [start, end), or
+ * `end` if they're all set. Bitmaps are scanned a 32-bit word at a time, they
+ * span whole blocks so words never go past their end.
+ */
+static uint32_t find_clear_bit(uint8_t* bitmap, uint32_t start, uint32_t end) {
+    uint32_t* words = (uint32_t*) bitmap;
+
+    if (start >= end) {
+        return end;
+    }
+
+    uint32_t i = start / 32;
+    uint32_t free = ~words[i] & (0xFFFFFFFF << (start % 32));
+
+    while (!free) {
+        if (++i*32 >= end) {
+            return end;
+        }
+
+        free = ~words[i];
+    }
+
+    uint32_t bit = i*32 + bsf(free);
+
+    return bit < end ? bit : end;
+}
+
+/* Returns the number of blocks in a group, which is less than
+ * `blocks_per_group` for the last one.
+ */
+static uint32_t group_blocks(ext2_fs_t* fs, uint32_t group) {
+    uint32_t left = fs->sb->blocks_count - fs->sb->superblock_block - group*fs->sb->blocks_per_group;
+
+    return left < fs->sb->blocks_per_group ? left : fs->sb->blocks_per_group;
+}
+
+/* Allocates the first free block at or after `goal`, looking in the following
+ * groups and wrapping around if needed, along with the free blocks directly
+ * following it, up to `max` blocks in all. Their number is written to `count`.
+ * Returns the first block allocated, or zero if the disk is full.
+ */
+static uint32_t allocate_blocks(ext2_fs_t* fs, uint32_t goal, uint32_t max, uint32_t* count) {
     if (!fs->sb->free_blocks) {
         return 0;
     }
 
-    /* Find the first non-full block group */
-    uint32_t group;
-    for (group = 0; group < fs->num_block_groups; group++) {
-        if (fs->group_descriptors[group].free_blocs) {
-            break;
-        }
+    uint32_t first = fs->sb->superblock_block;
+
+    if (goal < first || goal >= fs->sb->blocks_count) {
+        goal = first;
     }
 
-    /* Go through the bitmap */
-    uint32_t bitmap_block = fs->group_descriptors[group].block_bitmap;
-    uint32_t block_offset = 0;
-    uint8_t* tmp = kmalloc(fs->block_size);
+    uint32_t goal_group = (goal - first) / fs->sb->blocks_per_group;
+    uint32_t goal_bit = (goal - first) % fs->sb->blocks_per_group;
+
+    // The goal group is visited twice: from the goal, then up to it
+    for (uint32_t i = 0; i <= fs->num_block_groups; i++) {
+        uint32_t group = (goal_group + i) % fs->num_block_groups;
+        uint32_t size = group_blocks(fs, group);
+        uint32_t start = i == 0 ? goal_bit : 0;
+        uint32_t end = i == fs->num_block_groups ? goal_bit : size;
 
-    for (uint32_t i = 0; i < fs->sb->blocks_per_group; i++) {
-        if (i % (8 * fs->block_size) == 0) {
-            read_block(fs, bitmap_block + block_offset++, tmp);
+        if (!fs->group_descriptors[group].free_blocs) {
+            continue;
         }
 
-        uint32_t rel_i = i - (block_offset - 1) * 8 * fs->block_size;
-        uint8_t chunk = tmp[rel_i / 8];
+        uint8_t* bitmap = get_block_bitmap(fs, group);
+        uint32_t bit = find_clear_bit(bitmap, start, end);
 
-        /* Free block found: update disk structures */
-        if (!(chunk & (1 << (rel_i % 8)))) {
-            tmp[rel_i / 8] = chunk | 1 << (rel_i % 8);
-            write_block(fs, bitmap_block + block_offset - 1, tmp);
-            kfree(tmp);
+        if (bit == end) {
+            continue;
+        }
 
-            fs->sb->free_blocks--;
-            fs->group_descriptors[group].free_blocs--;
-            write_superblock(fs);
-            write_group_descriptor(fs, group);
+        uint32_t n = 0;
 
-            return group * fs->sb->blocks_per_group + i + 1;
+        while (n < max && bit + n < size && !(bitmap[(bit + n) / 8] & (1 << ((bit + n) % 8)))) {
+            bitmap[(bit + n) / 8] |= 1 << ((bit + n) % 8);
+            n++;
         }
+
+        fs->sb->free_blocks -= n;
+        fs->group_descriptors[group].free_blocs -= n;
+        mark_group_dirty(fs, group);
+        *count = n;
+
+        // The first bit is the first data block
+        return group * fs->sb->blocks_per_group + bit + first;
     }
 
     printke("block allocation failed when it shouldn't have");
@@ -650,59 +1094,96 @@ static uint32_t allocate_block(ext2_fs_t* fs) {
     return 0;
 }
 
+/* Returns a new block for the inode, marking it as used. It's taken from the
+ * inode's preallocation window if it has one. Otherwise we aim for the block
+ * after the last one the inode got, or for its group for new inodes, and
+ * reserve the next few blocks.
+ */
+static uint32_t allocate_inode_block(ext2_fs_t* fs, ext2_cached_inode_t* ci) {
+    if (ci->prealloc_count) {
+        ci->prealloc_count--;
+        ci->last_block = ci->prealloc_block++;
+
+        return ci->last_block;
+    }
+
+    if (!ci->last_block && ci->in.size_lower) {
+        ci->last_block = get_inode_block(fs, &ci->in, divide_up(ci->in.size_lower, fs->block_size) - 1);
+    }
+
+    uint32_t goal = ci->last_block + 1;
+
+    if (!ci->last_block) {
+        uint32_t group = (ci->ino - 1) / fs->sb->inodes_per_group;
+        goal = fs->sb->superblock_block + group*fs->sb->blocks_per_group;
+    }
+
+    uint32_t count = 0;
+    uint32_t block = allocate_blocks(fs, goal, 1 + PREALLOC_BLOCKS, &count);
+
+    if (block) {
+        ci->last_block = block;
+        ci->prealloc_block = block + 1;
+        ci->prealloc_count = count - 1;
+    }
+
+    return block;
+}
+
+/* Frees the blocks reserved for the inode but not used yet.
+ */
+static void discard_prealloc(ext2_fs_t* fs, ext2_cached_inode_t* ci) {
+    while (ci->prealloc_count) {
+        ci->prealloc_count--;
+        free_block(fs, ci->prealloc_block + ci->prealloc_count);
+    }
+}
+
 static void free_block(ext2_fs_t* fs, uint32_t block) {
-    uint32_t group_no = block / fs->sb->blocks_per_group;
-    uint32_t bitmap_block = fs->group_descriptors[group_no].block_bitmap;
-    uint32_t rel_block = block % fs->sb->blocks_per_group;
-    uint32_t block_offset = rel_block / (8 * fs->block_size);
-    uint8_t* bitmap = kmalloc(fs->block_size);
+    uint32_t rel_block = block - fs->sb->superblock_block;
+    uint32_t group_no = rel_block / fs->sb->blocks_per_group;
+    uint32_t bit = rel_block % fs->sb->blocks_per_group;
+    uint8_t* bitmap = get_block_bitmap(fs, group_no);
 
-    read_block(fs, bitmap_block + block_offset, bitmap);
-    bitmap[rel_block / 8] &= ~(1 << (rel_block % 8));
-    write_block(fs, bitmap_block + block_offset, bitmap);
-    kfree(bitmap);
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
 
     fs->sb->free_blocks++;
     fs->group_descriptors[group_no].free_blocs++;
-    write_superblock(fs);
-    write_group_descriptor(fs, group_no);
+    mark_group_dirty(fs, group_no);
 }
 
-/* Returns the first free inode number available.
+/* Returns a free inode number, marking it as used. Inodes are taken from
+ * `goal_group` if possible, typically that of their parent directory, or from
+ * the groups after it.
  */
-static uint32_t allocate_inode(ext2_fs_t* fs) {
+static uint32_t allocate_inode(ext2_fs_t* fs, uint32_t goal_group) {
     if (!fs->sb->free_inodes) {
         printke("allocate_inode: no inodes left");
         return 0;
     }
 
-    /* Find a block group with a free inode */
-    uint32_t group;
-    for (group = 0; group < fs->num_block_groups; group++) {
-        if (fs->group_descriptors[group].free_inodes) {
-            break;
+    for (uint32_t i = 0; i < fs->num_block_groups; i++) {
+        uint32_t group = (goal_group + i) % fs->num_block_groups;
+
+        if (!fs->group_descriptors[group].free_inodes) {
+            continue;
         }
-    }
 
-    /* Go through the bitmap, knowing it's at most a block long */
-    uint8_t* tmp = kmalloc(fs->block_size);
-    uint32_t bitmap_block = fs->group_descriptors[group].inode_bitmap;
-    read_block(fs, bitmap_block, tmp);
+        uint8_t* bitmap = get_inode_bitmap(fs, group);
+        uint32_t bit = find_clear_bit(bitmap, 0, fs->sb->inodes_per_group);
 
-    for (uint32_t i = 0; i < fs->sb->inodes_per_group; i++) {
-        if (!(tmp[i / 8] & (1 << (i % 8)))) {
-            tmp[i / 8] |= 1 << (i % 8);
-            write_block(fs, bitmap_block, tmp);
-            kfree(tmp);
+        if (bit == fs->sb->inodes_per_group) {
+            continue;
+        }
 
-            fs->group_descriptors[group].free_inodes--;
-            fs->sb->free_inodes--;
-            write_superblock(fs);
-            write_group_descriptor(fs, group);
+        bitmap[bit / 8] |= 1 << (bit % 8);
 
-            // The first bit is inode no. 1
-            return i + 1;
-        }
+        fs->group_descriptors[group].free_inodes--;
+        fs->sb->free_inodes--;
+        mark_group_dirty(fs, group);
+
+        // The first bit is inode no. 1
+        return group * fs->sb->inodes_per_group + bit + 1;
     }
 
     printke("inode allocation failed when it shouldn't have");
@@ -716,29 +1197,19 @@ static uint32_t allocate_inode(ext2_fs_t* fs) {
 static void free_inode(ext2_fs_t* fs, uint32_t ino) {
     /* Free the blocks owned by the inode */
     ext2_inode_t* in = get_inode(fs, ino);
-    uint32_t num_blocks = divide_up(in->size_lower, fs->block_size);
-    kfree(in);
-
-    for (uint32_t iblock = 0; iblock < num_blocks; iblock++) {
-        uint32_t rblock = get_inode_block(fs, in, iblock);
-        free_block(fs, rblock);
-    }
+    truncate_blocks(fs, in, 0);
+    put_inode(fs, in);
 
     /* Free the inode itself */
-    uint8_t* bitmap = kmalloc(fs->block_size);
-    uint32_t group_no = ino / fs->sb->inodes_per_group;
-    uint32_t bitmap_block = fs->group_descriptors[group_no].inode_bitmap;
+    uint32_t group_no = (ino - 1) / fs->sb->inodes_per_group;
     uint32_t rel_ino = (ino - 1) % fs->sb->inodes_per_group;
+    uint8_t* bitmap = get_inode_bitmap(fs, group_no);
 
-    read_block(fs, bitmap_block, bitmap);
     bitmap[rel_ino / 8] &= ~(1 << (rel_ino % 8));
-    write_block(fs, bitmap_block, bitmap);
-    kfree(bitmap);
 
     fs->group_descriptors[group_no].free_inodes++;
     fs->sb->free_inodes++;
-    write_superblock(fs);
-    write_group_descriptor(fs, group_no);
+    mark_group_dirty(fs, group_no);
 }
 
 /* Returns the minimum size of a directory entry with the given filename.
@@ -747,21 +1218,6 @@ static uint32_t min_dir_entry_size(const char* name) {
     return align_to(sizeof(ext2_directory_entry_t) + strlen(name), 4);
 }
 
-/* Update the inode no. `no` on disk with the content of `in`.
- */
-static void update_inode(ext2_fs_t* fs, uint32_t ino, ext2_inode_t* in) {
-    uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
-    uint32_t table_block = fs->group_descriptors[group].inode_table;
-    uint32_t block_offset = ((ino - 1) * fs->inode_size) / fs->block_size;
-    uint32_t offset_in_block = ((ino - 1) * fs->inode_size) % fs->block_size;
-
-    uint8_t* tmp = kmalloc(fs->block_size);
-    read_block(fs, table_block + block_offset, tmp);
-    memcpy(tmp + offset_in_block, in, fs->inode_size);
-    write_block(fs, table_block + block_offset, tmp);
-    kfree(tmp);
-}
-
 /* Returns the nth data block of an inode, creating it if it doesn't exist.
  * Modifies the given inode in place, but not on disk, this is the caller's
  * job.
@@ -771,10 +1227,11 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
     // Number of block pointers in an indirect block
     uint32_t p = fs->block_size / sizeof(uint32_t);
     uint32_t ret = 0;
+    ext2_cached_inode_t* ci = (ext2_cached_inode_t*) in;
 
     if (n < 12) {
         if (!in->dbp[n]) {
-            in->dbp[n] = allocate_block(fs);
+            in->dbp[n] = allocate_inode_block(fs, ci);
         }
 
         ret = in->dbp[n];
@@ -783,14 +1240,14 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t relblock = n - 12;
 
         if (!in->sibp) {
-            in->sibp = allocate_block(fs);
+            in->sibp = allocate_inode_block(fs, ci);
             write_block(fs, in->sibp, (uint8_t*) tmp);
         }
 
         read_block(fs, in->sibp, (uint8_t*) tmp);
 
         if (!tmp[relblock]) {
-            tmp[relblock] = allocate_block(fs);
+            tmp[relblock] = allocate_inode_block(fs, ci);
             write_block(fs, in->sibp, (uint8_t*) tmp);
         }
 
@@ -803,14 +1260,14 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t offset_b = relblock % p;
 
         if (!in->dibp) {
-            in->dibp = allocate_block(fs);
+            in->dibp = allocate_inode_block(fs, ci);
             clear_block(fs, in->dibp);
         }
 
         read_block(fs, in->dibp, (uint8_t*) tmp);
 
         if (!tmp[offset_a]) {
-            tmp[offset_a] = allocate_block(fs);
+            tmp[offset_a] = allocate_inode_block(fs, ci);
             clear_block(fs, tmp[offset_a]);
             write_block(fs, in->dibp, (uint8_t*) tmp);
         }
@@ -819,7 +1276,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_a], (uint8_t*) tmp);
 
         if (!tmp[offset_b]) {
-            tmp[offset_b] = allocate_block(fs);
+            tmp[offset_b] = allocate_inode_block(fs, ci);
             write_block(fs, block_a, (uint8_t*) tmp);
         }
 
@@ -833,14 +1290,14 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         uint32_t offset_c = relblock % p;
 
         if (!in->tibp) {
-            in->tibp = allocate_block(fs);
+            in->tibp = allocate_inode_block(fs, ci);
             clear_block(fs, in->tibp);
         }
 
         read_block(fs, in->tibp, (uint8_t*) tmp);
 
         if (!tmp[offset_a]) {
-            tmp[offset_a] = allocate_block(fs);
+            tmp[offset_a] = allocate_inode_block(fs, ci);
             clear_block(fs, tmp[offset_a]);
             write_block(fs, in->tibp, (uint8_t*) tmp);
         }
@@ -849,7 +1306,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_a], (uint8_t*) tmp);
 
         if (!tmp[offset_b]) {
-            tmp[offset_b] = allocate_block(fs);
+            tmp[offset_b] = allocate_inode_block(fs, ci);
             clear_block(fs, tmp[offset_b]);
             write_block(fs, block_a, (uint8_t*) tmp);
         }
@@ -858,7 +1315,7 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         read_block(fs, tmp[offset_b], (uint8_t*) tmp);
 
         if (!tmp[offset_c]) {
-            tmp[offset_c] = allocate_block(fs);
+            tmp[offset_c] = allocate_inode_block(fs, ci);
             write_block(fs, block_b, (uint8_t*) tmp);
         }
 
@@ -868,14 +1325,37 @@ static uint32_t get_or_create_inode_block(ext2_fs_t* fs, ext2_inode_t* in, uint3
         printke("invalid inode block");
     }
 
+    block_map_set(ci, n, ret);
+
     return ret;
 }
 
 /* Returns the nth data block of an inode, or zero if it does not exist.
  * Note: returning zero may simply mean that we're reading a sparse file;
  * such blocks are defined as containing only zeros.
+ * Blocks past the direct ones are looked up in the inode's block map.
  */
 static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n) {
+    ext2_cached_inode_t* ci = (ext2_cached_inode_t*) inode;
+
+    if (n < 12) {
+        return inode->dbp[n];
+    }
+
+    if (!ci->block_map) {
+        build_block_map(fs, ci);
+    }
+
+    if (n < ci->block_map_len) {
+        return ci->block_map[n];
+    }
+
+    return walk_inode_block(fs, inode, n);
+}
+
+/* Looks up the nth data block of an inode through its indirect blocks.
+ */
+static uint32_t walk_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n) {
     // Number of block pointers in an indirect block
     uint32_t p = fs->block_size / sizeof(uint32_t);
     uint32_t ret = 0;
@@ -886,8 +1366,7 @@ static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n)
         uint32_t* tmp = kmalloc(fs->block_size);
         uint32_t relblock = n - 12;
 
-        read_block(fs, inode->sibp, (uint8_t*) tmp);
-        ret = tmp[relblock];
+        ret = read_block_pointer(fs, inode->sibp, relblock, tmp);
         kfree(tmp);
     } else if (n < 12 + p + p*p) {
         uint32_t* tmp = kmalloc(fs->block_size);
@@ -895,9 +1374,8 @@ static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n)
         uint32_t offset_a = relblock / p;
         uint32_t offset_b = relblock % p;
 
-        read_block(fs, inode->dibp, (uint8_t*) tmp);
-        read_block(fs, tmp[offset_a], (uint8_t*) tmp);
-        ret = tmp[offset_b];
+        ret = read_block_pointer(fs, inode->dibp, offset_a, tmp);
+        ret = read_block_pointer(fs, ret, offset_b, tmp);
         kfree(tmp);
     } else if (n < 12 + p + p*p + p*p*p) { // TODO: test this
         uint32_t* tmp = kmalloc(fs->block_size);
@@ -906,10 +1384,9 @@ static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n)
         uint32_t offset_b = relblock % (p*p);
         uint32_t offset_c = relblock % p;
 
-        read_block(fs, inode->tibp, (uint8_t*) tmp);
-        read_block(fs, tmp[offset_a], (uint8_t*) tmp);
-        read_block(fs, tmp[offset_b], (uint8_t*) tmp);
-        ret = tmp[offset_c];
+        ret = read_block_pointer(fs, inode->tibp, offset_a, tmp);
+        ret = read_block_pointer(fs, ret, offset_b, tmp);
+        ret = read_block_pointer(fs, ret, offset_c, tmp);
         kfree(tmp);
     } else {
         printke("invalid inode block");
@@ -918,6 +1395,200 @@ static uint32_t get_inode_block(ext2_fs_t* fs, ext2_inode_t* inode, uint32_t n)
     return ret;
 }
 
+/* Returns the `index`th block pointer of the indirect block `block`, using
+ * `tmp` as a buffer. A zero `block` is a hole, all of whose pointers are zero:
+ * block zero isn't read, as it holds the superblock.
+ */
+static uint32_t read_block_pointer(ext2_fs_t* fs, uint32_t block, uint32_t index, uint32_t* tmp) {
+    if (!block) {
+        return 0;
+    }
+
+    read_block(fs, block, (uint8_t*) tmp);
+
+    return tmp[index];
+}
+
+/* Builds the block map of an inode, covering the blocks within its size.
+ */
+static void build_block_map(ext2_fs_t* fs, ext2_cached_inode_t* ci) {
+    uint32_t count = divide_up(ci->in.size_lower, fs->block_size);
+    uint32_t cap = count ? count : 1;
+    uint32_t* map = kmalloc(cap*sizeof(uint32_t));
+    uint32_t n = 0;
+
+    for (; n < count && n < 12; n++) {
+        map[n] = ci->in.dbp[n];
+    }
+
+    n += map_indirect_block(fs, ci->in.sibp, 0, map + n, count - n);
+    n += map_indirect_block(fs, ci->in.dibp, 1, map + n, count - n);
+    n += map_indirect_block(fs, ci->in.tibp, 2, map + n, count - n);
+
+    ci->block_map = map;
+    ci->block_map_len = n;
+    ci->block_map_cap = cap;
+}
+
+/* Writes to `map` the block numbers referenced by the indirect block `block`,
+ * recursing `depth` times, stopping after `count` of them.
+ * Returns the number of entries written.
+ */
+static uint32_t map_indirect_block(ext2_fs_t* fs, uint32_t block, uint32_t depth, uint32_t* map, uint32_t count) {
+    uint32_t p = fs->block_size / sizeof(uint32_t);
+    uint32_t span = p;
+
+    for (uint32_t i = 0; i < depth; i++) {
+        span *= p;
+    }
+
+    if (span < count) {
+        count = span;
+    }
+
+    if (!count) {
+        return 0;
+    }
+
+    if (!block) {
+        memset(map, 0, count*sizeof(uint32_t));
+        return count;
+    }
+
+    uint32_t* ptrs = kmalloc(fs->block_size);
+    uint32_t n = 0;
+
+    read_block(fs, block, (uint8_t*) ptrs);
+
+    for (uint32_t i = 0; i < p && n < count; i++) {
+        if (depth == 0) {
+            map[n++] = ptrs[i];
+        } else {
+            n += map_indirect_block(fs, ptrs[i], depth - 1, map + n, count - n);
+        }
+    }
+
+    kfree(ptrs);
+
+    return n;
+}
+
+/* Records in the inode's block map, if it has one, that its `n`-th block is
+ * `block`. The map grows to include blocks appended past its end.
+ */
+static void block_map_set(ext2_cached_inode_t* ci, uint32_t n, uint32_t block) {
+    if (!ci->block_map || n > ci->block_map_len) {
+        free_block_map(ci);
+        return;
+    }
+
+    if (n == ci->block_map_cap) {
+        uint32_t* map = kmalloc(2*ci->block_map_cap*sizeof(uint32_t));
+        memcpy(map, ci->block_map, ci->block_map_len*sizeof(uint32_t));
+        kfree(ci->block_map);
+
+        ci->block_map = map;
+        ci->block_map_cap *= 2;
+    }
+
+    if (n == ci->block_map_len) {
+        ci->block_map_len++;
+    }
+
+    ci->block_map[n] = block;
+}
+
+static void free_block_map(ext2_cached_inode_t* ci) {
+    if (ci->block_map) {
+        kfree(ci->block_map);
+        ci->block_map = NULL;
+    }
+}
+
+/* Frees the data blocks of an inode from the `first`-th on, along with the
+ * indirect blocks no longer needed, and clears the pointers to them.
+ * Modifies the inode in place, it's the caller's job to mark it dirty.
+ */
+static void truncate_blocks(ext2_fs_t* fs, ext2_inode_t* in, uint32_t first) {
+    ext2_cached_inode_t* ci = (ext2_cached_inode_t*) in;
+    uint32_t p = fs->block_size / sizeof(uint32_t);
+
+    discard_prealloc(fs, ci);
+    free_block_map(ci);
+    ci->last_block = 0;
+
+    for (uint32_t n = first; n < 12; n++) {
+        if (in->dbp[n]) {
+            free_block(fs, in->dbp[n]);
+            in->dbp[n] = 0;
+        }
+    }
+
+    uint32_t from = first > 12 ? first - 12 : 0;
+
+    if (in->sibp && from < p && truncate_indirect_block(fs, in->sibp, 0, from)) {
+        in->sibp = 0;
+    }
+
+    from = first > 12 + p ? first - 12 - p : 0;
+
+    if (in->dibp && from < p*p && truncate_indirect_block(fs, in->dibp, 1, from)) {
+        in->dibp = 0;
+    }
+
+    from = first > 12 + p + p*p ? first - 12 - p - p*p : 0;
+
+    if (in->tibp && truncate_indirect_block(fs, in->tibp, 2, from)) {
+        in->tibp = 0;
+    }
+}
+
+/* Frees the blocks the indirect block `block` refers to, recursing `depth`
+ * times, from the `from`-th block it covers on.
+ * Returns whether it no longer refers to any, in which case it's freed too.
+ */
+static bool truncate_indirect_block(ext2_fs_t* fs, uint32_t block, uint32_t depth, uint32_t from) {
+    uint32_t p = fs->block_size / sizeof(uint32_t);
+    uint32_t span = 1; // Number of blocks covered by each pointer
+
+    for (uint32_t i = 0; i < depth; i++) {
+        span *= p;
+    }
+
+    uint32_t* ptrs = kmalloc(fs->block_size);
+    bool empty = true;
+
+    read_block(fs, block, (uint8_t*) ptrs);
+
+    for (uint32_t i = 0; i < p; i++) {
+        if (!ptrs[i] || i < from / span) {
+            empty = empty && !ptrs[i];
+            continue;
+        }
+
+        uint32_t sub_from = i == from / span ? from % span : 0;
+
+        if (depth == 0) {
+            free_block(fs, ptrs[i]);
+            ptrs[i] = 0;
+        } else if (truncate_indirect_block(fs, ptrs[i], depth - 1, sub_from)) {
+            ptrs[i] = 0;
+        } else {
+            empty = false;
+        }
+    }
+
+    if (empty) {
+        free_block(fs, block);
+    } else {
+        write_block(fs, block, (uint8_t*) ptrs);
+    }
+
+    kfree(ptrs);
+
+    return empty;
+}
+
 /* Creates a new entry with name `name` in the directory pointed to by
  * `parent_inode` with type `type`, one of the DTYPE_* constants.
  * Returns the inode of the created file.
@@ -926,151 +1597,240 @@ static uint32_t add_directory_entry(ext2_fs_t* fs, const char* name, uint32_t d_
     ext2_inode_t* d_in = get_inode(fs, d_ino);
 
     if (!d_in || INODE_TYPE(d_in->type_perms) != INODE_DIR) {
+        put_inode(fs, d_in);
         return 0;
     }
 
-    list_t* entries = directory_to_entries(fs, d_ino);
-    uint32_t ino = allocate_inode(fs);
-    ext2_inode_t in;
+    uint32_t ino = allocate_inode(fs, (d_ino - 1) / fs->sb->inodes_per_group);
+    ext2_inode_t* in = ino ? get_inode(fs, ino) : NULL;
 
-    // Create the new inode
-    memset(&in, 0, sizeof(ext2_inode_t));
-    in.hardlinks_count = 1;
-    list_add(entries, make_directory_entry(name, ino, type));
+    if (!in) {
+        put_inode(fs, d_in);
+        return 0;
+    }
 
-    // Write the parent directory structure to disk
-    write_directory_entries(fs, d_ino, entries);
+    // Create the new inode
+    memset(in, 0, sizeof(ext2_inode_t));
+    in->hardlinks_count = 1;
 
-    // If it's a directory, write its entries to disk
+    // If it's a directory, give it its "." and ".." entries
     if (type == DENT_DIRECTORY) {
-        in.type_perms = INODE_DIR;
-        update_inode(fs, ino, &in);
+        uint8_t* tmp = zalloc(fs->block_size);
+        ext2_directory_entry_t* dot = (ext2_directory_entry_t*) tmp;
+        fill_directory_entry(dot, ".", ino, DENT_DIRECTORY);
+        dot->entry_size = min_dir_entry_size(".");
+
+        ext2_directory_entry_t* dots = (ext2_directory_entry_t*) (tmp + dot->entry_size);
+        fill_directory_entry(dots, "..", d_ino, DENT_DIRECTORY);
+        dots->entry_size = fs->block_size - dot->entry_size;
+
+        in->type_perms = INODE_DIR;
+        write_inode_block(fs, in, 0, tmp);
+        in->size_lower = fs->block_size;
+        kfree(tmp);
 
-        list_t dot_list = LIST_HEAD_INIT(dot_list);
+        // Account for "." and ".."
+        uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
+        in->hardlinks_count++;
+        d_in->hardlinks_count++;
+        mark_inode_dirty(fs, d_in);
+        fs->group_descriptors[group].directories_count++;
+        mark_group_dirty(fs, group);
+    } else {
+        in->type_perms = INODE_FILE;
+    }
 
-        dentry_t* dot = make_directory_entry(".", ino, DENT_DIRECTORY);
-        dentry_t* dots = make_directory_entry("..", d_ino, DENT_DIRECTORY);
+    mark_inode_dirty(fs, in);
 
-        list_add(&dot_list, dot);
-        list_add(&dot_list, dots);
+    // Without room in the parent, undo everything
+    if (!insert_directory_entry(fs, d_in, name, ino, type)) {
+        if (type == DENT_DIRECTORY) {
+            uint32_t group = (ino - 1) / fs->sb->inodes_per_group;
+            d_in->hardlinks_count--;
+            mark_inode_dirty(fs, d_in);
+            fs->group_descriptors[group].directories_count--;
+            mark_group_dirty(fs, group);
+        }
 
-        write_directory_entries(fs, ino, &dot_list);
-        free_directory_entries(&dot_list);
-    } else {
-        in.type_perms = INODE_FILE;
-        update_inode(fs, ino, &in);
+        in->hardlinks_count = 0;
+        free_inode(fs, ino);
+        ino = 0;
     }
 
-    // Free the list of entries, and the rest
-    free_directory_entries(entries);
-    kfree(entries);
-    kfree(d_in);
+    put_inode(fs, in);
+    put_inode(fs, d_in);
 
     return ino;
 }
 
-/* Returns a list of `dentry_t` corresponding to the entries in the directory
- * whose inode was given.
+/* Writes the fields of a directory entry, except for its size.
+ * `type` is one of the `DENT_*` constants.
  */
-static list_t* directory_to_entries(ext2_fs_t* fs, uint32_t ino) {
-    list_t* list = kmalloc(sizeof(list_t));
-    *list = LIST_HEAD_INIT(*list);
+static void fill_directory_entry(ext2_directory_entry_t* ent, const char* name, uint32_t ino, uint32_t type) {
+    ent->inode = ino;
+    ent->name_len_low = strlen(name);
+    ent->type = type == DENT_DIRECTORY ? DTYPE_DIR : DTYPE_FILE;
+    memcpy(ent->name, name, ent->name_len_low);
+}
 
-    sos_directory_entry_t* ent = NULL;
-    ext2_inode_t* in = get_inode(fs, ino);
-    uint32_t offset = 0;
+/* Adds an entry to the directory `d_in`, in the first record with enough slack
+ * space after its own entry, splitting it. If there's none, a block is added to
+ * the directory. Only one block is written either way.
+ * Returns whether the entry could be added.
+ */
+static bool insert_directory_entry(ext2_fs_t* fs, ext2_inode_t* d_in, const char* name, uint32_t ino, uint32_t type) {
+    uint32_t needed = min_dir_entry_size(name);
+    uint32_t num_blocks = d_in->size_lower / fs->block_size;
+    uint8_t* tmp = kmalloc(fs->block_size);
 
-    if (!in) {
-        kfree(list);
-        return NULL;
-    }
+    drop_directory_index(fs, d_in);
 
-    while (offset < in->size_lower) {
-        ent = ext2_readdir(fs, ino, offset);
+    for (uint32_t n = 0; n < num_blocks; n++) {
+        read_inode_block(fs, d_in, n, tmp);
 
-        if (!ent) {
-            break;
+        for (uint32_t offset = 0; offset < fs->block_size;) {
+            ext2_directory_entry_t* ent = (ext2_directory_entry_t*) &tmp[offset];
+
+            if (!ent->entry_size) {
+                break;
+            }
+
+            uint32_t used = 0;
+
+            if (ent->inode) {
+                used = align_to(sizeof(ext2_directory_entry_t) + ent->name_len_low, 4);
+            }
+
+            if (ent->entry_size - used >= needed) {
+                if (used) {
+                    ext2_directory_entry_t* new = (ext2_directory_entry_t*) &tmp[offset + used];
+                    new->entry_size = ent->entry_size - used;
+                    ent->entry_size = used;
+                    ent = new;
+                }
+
+                fill_directory_entry(ent, name, ino, type);
+                write_inode_block(fs, d_in, n, tmp);
+                kfree(tmp);
+
+                return true;
+            }
+
+            offset += ent->entry_size;
         }
+    }
 
-        dentry_t* tn = kmalloc(sizeof(dentry_t));
-        tn->name = strndup(ent->name, ent->name_len_low);
-        tn->inode = ent->inode;
+    // No room left, start a new block
+    memset(tmp, 0, fs->block_size);
 
-        list_add(list, tn);
+    ext2_directory_entry_t* ent = (ext2_directory_entry_t*) tmp;
+    fill_directory_entry(ent, name, ino, type);
+    ent->entry_size = fs->block_size;
 
-        offset += ent->entry_size;
-        kfree(ent);
+    uint32_t block = get_or_create_inode_block(fs, d_in, num_blocks);
+
+    if (block) {
+        write_block(fs, block, tmp);
     }
 
-    kfree(in);
+    kfree(tmp);
 
-    return list;
+    if (!block) {
+        return false;
+    }
+
+    d_in->size_lower += fs->block_size;
+    mark_inode_dirty(fs, d_in);
+
+    return true;
 }
 
-/* With `ino` that of a directory, write to it each dentry_t in `dir_entries`.
+/* Removes the entry referencing `ino` from the directory `d_in` by merging its
+ * record into the previous one in its block, or by marking it unused if it's
+ * the first. Only that block is written.
+ * If `name` isn't NULL, the entry's name and type are written to `name` and
+ * `type`.
+ * Returns whether an entry was found.
  */
-static void write_directory_entries(ext2_fs_t* fs, uint32_t ino, list_t* dir_entries) {
-    ext2_inode_t* in = get_inode(fs, ino);
+static bool remove_directory_entry(ext2_fs_t* fs, ext2_inode_t* d_in, uint32_t ino, char* name, uint32_t* type) {
+    uint32_t num_blocks = d_in->size_lower / fs->block_size;
+    uint8_t* tmp = kmalloc(fs->block_size);
 
-    if (INODE_TYPE(in->type_perms) != INODE_DIR) {
-        return;
-    }
+    for (uint32_t n = 0; n < num_blocks; n++) {
+        ext2_directory_entry_t* prev = NULL;
 
-    uint8_t* tmp = kmalloc(fs->block_size);
-    ext2_directory_entry_t* ent = NULL;
-    uint32_t offset = 0;
-    uint32_t iblock_no = 0;
-    dentry_t* tn;
-    list_t* iter;
-
-    list_for_each(iter, tn, dir_entries) {
-        /* Switch to the next iblock, resize the previous entry to fill the block */
-        if (offset + min_dir_entry_size(tn->name) >= fs->block_size) {
-            printk("write_directory_entries: more than one block");
-            offset -= ent->entry_size;
-            ent->entry_size = fs->block_size - offset;
-            offset = 0;
-            write_inode_block(fs, in, iblock_no++, tmp);
-        }
+        read_inode_block(fs, d_in, n, tmp);
 
-        ent = (ext2_directory_entry_t*) &tmp[offset];
-        bool last = list_last_entry(dir_entries, dentry_t) == tn;
+        for (uint32_t offset = 0; offset < fs->block_size;) {
+            ext2_directory_entry_t* ent = (ext2_directory_entry_t*) &tmp[offset];
 
-        ent->inode = tn->inode;
-        ent->name_len_low = strlen(tn->name);
-        ent->type = tn->type;
-        ent->entry_size = last ? fs->block_size - offset : min_dir_entry_size(tn->name);
-        strncpy(ent->name, tn->name, strlen(tn->name));
+            if (!ent->entry_size) {
+                break;
+            }
 
-        offset += ent->entry_size;
-    }
+            if (ent->inode == ino) {
+                if (name) {
+                    memcpy(name, ent->name, ent->name_len_low);
+                    name[ent->name_len_low] = '\0';
+                    *type = ent->type == DTYPE_DIR ? DENT_DIRECTORY : DENT_FILE;
+                }
+
+                if (prev) {
+                    prev->entry_size += ent->entry_size;
+                } else {
+                    ent->inode = 0;
+                }
 
-    write_inode_block(fs, in, iblock_no, tmp);
+                drop_directory_index(fs, d_in);
+                write_inode_block(fs, d_in, n, tmp);
+                kfree(tmp);
 
-    in->size_lower = fs->block_size * iblock_no + offset;
-    update_inode(fs, ino, in);
+                return true;
+            }
+
+            prev = ent;
+            offset += ent->entry_size;
+        }
+    }
 
     kfree(tmp);
-    kfree(in);
+
+    return false;
 }
 
-static dentry_t* make_directory_entry(const char* name, uint32_t ino, uint32_t type) {
-    dentry_t* tn = kmalloc(sizeof(dentry_t));
+/* Points the ".." entry of the directory `d_in` to `parent_ino`. It's in the
+ * first block, after ".".
+ */
+static void set_parent_entry(ext2_fs_t* fs, ext2_inode_t* d_in, uint32_t parent_ino) {
+    uint8_t* tmp = kmalloc(fs->block_size);
 
-    tn->inode = ino;
-    tn->name = strdup(name);
-    tn->type = type == DENT_DIRECTORY ? DTYPE_DIR : DTYPE_FILE;
+    read_inode_block(fs, d_in, 0, tmp);
 
-    return tn;
+    for (uint32_t offset = 0; offset < fs->block_size;) {
+        ext2_directory_entry_t* ent = (ext2_directory_entry_t*) &tmp[offset];
+
+        if (!ent->entry_size) {
+            break;
+        }
+
+        if (ent->name_len_low == 2 && !memcmp(ent->name, "..", 2)) {
+            ent->inode = parent_ino;
+            drop_directory_index(fs, d_in);
+            write_inode_block(fs, d_in, 0, tmp);
+            break;
+        }
+
+        offset += ent->entry_size;
+    }
+
+    kfree(tmp);
 }
 
-/* Does not free the list itself.
+/* Clears the hash tree index flag of a directory we're about to change.
  */
-static void free_directory_entries(list_t* entries) {
-    while (!list_empty(entries)) {
-        dentry_t* tn = list_first_entry(entries, dentry_t);
-        kfree(tn->name);
-        kfree(tn);
-        list_del(list_first(entries));
-    }
-}
\ No newline at end of file
+static void drop_directory_index(ext2_fs_t* fs, ext2_inode_t* d_in) {
+    if (d_in->flags & INODE_FLAG_INDEX) {
+        d_in->flags &= ~INODE_FLAG_INDEX;
+        mark_inode_dirty(fs, d_in);
+    }
+}
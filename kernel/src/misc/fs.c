@@ -1,6 +1,9 @@
 #include <kernel/fs.h>
+#include <kernel/image.h>
+#include <kernel/page_cache.h>
 #include <kernel/proc.h>
 #include <kernel/sys.h>
+#include <kernel/timer.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -15,15 +18,166 @@ typedef struct tnode_t {
     inode_t* inode;
 } tnode_t;
 
-char* dirname(const char* p);
+/* Number of buckets of the dentry cache, and number of entries after which
+ * it's emptied.
+ */
+#define DCACHE_BUCKETS 256
+#define DCACHE_MAX_ENTRIES 1024
+
+/* Mounted filesystems are synced this often, in seconds.
+ */
+#define FS_SYNC_INTERVAL 5
+
+/* A cached lookup of the name `name` in the directory `parent`. Negative
+ * entries, with a NULL `tnode`, remember that the name doesn't exist.
+ */
+typedef struct dentry_t {
+    folder_inode_t* parent;
+    uint32_t hash;
+    uint32_t name_len;
+    char* name;
+    tnode_t* tnode;
+    struct dentry_t* next;
+} dentry_t;
+
+char* dirname(const char* p, char* buf);
 char* basename(const char* p);
 uint32_t tnode_to_directory_entry(tnode_t* tn, sos_directory_entry_t* d_ent, uint32_t size);
 void fs_build_tree_level(folder_inode_t* dir_ino, inode_t* parent);
 
 static tnode_t* root;
+static kmem_cache_t* tnode_cache;
+static kmem_cache_t* dentry_cache;
+static dentry_t* dcache[DCACHE_BUCKETS];
+static uint32_t dcache_entries = 0;
+static list_t mounts;
+
+static void fs_sync_callback(registers_t* regs);
 
 void init_fs(fs_t* fs) {
+    tnode_cache = kmem_cache_create("tnode_t", sizeof(tnode_t), 0);
+    dentry_cache = kmem_cache_create("dentry_t", sizeof(dentry_t), 0);
+    mounts = LIST_HEAD_INIT(mounts);
     fs_mount("/", fs);
+
+    timer_register_callback(&fs_sync_callback);
+}
+
+/* Writes back the metadata cached by every mounted filesystem.
+ */
+void fs_sync() {
+    fs_t* fs;
+    list_for_each_entry(fs, &mounts) {
+        if (fs->sync) {
+            fs->sync(fs);
+        }
+    }
+}
+
+static void fs_sync_callback(registers_t* regs) {
+    UNUSED(regs);
+
+    if (timer_get_tick() % (FS_SYNC_INTERVAL*TIMER_FREQ) == 0) {
+        fs_sync();
+    }
+}
+
+/* FNV-1a hash of a path component.
+ */
+static uint32_t dcache_hash(const char* name, uint32_t len) {
+    uint32_t hash = 2166136261;
+
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static uint32_t dcache_bucket(folder_inode_t* parent, uint32_t hash) {
+    return (hash ^ ((uintptr_t) parent >> 4) * 2654435761) % DCACHE_BUCKETS;
+}
+
+/* Returns the cached entry for `name` in `parent`, if any.
+ */
+static dentry_t* dcache_lookup(folder_inode_t* parent, const char* name,
+        uint32_t len, uint32_t hash) {
+    dentry_t* dent = dcache[dcache_bucket(parent, hash)];
+
+    while (dent) {
+        if (dent->parent == parent && dent->hash == hash && dent->name_len == len &&
+                !strncmp(dent->name, name, len)) {
+            return dent;
+        }
+
+        dent = dent->next;
+    }
+
+    return NULL;
+}
+
+/* Empties the dentry cache.
+ */
+static void dcache_flush() {
+    for (uint32_t i = 0; i < DCACHE_BUCKETS; i++) {
+        while (dcache[i]) {
+            dentry_t* dent = dcache[i];
+            dcache[i] = dent->next;
+            kfree(dent->name);
+            kmem_cache_free(dentry_cache, dent);
+        }
+    }
+
+    dcache_entries = 0;
+}
+
+/* Remembers that `name` resolves to `tnode` in `parent`, or doesn't exist if
+ * `tnode` is NULL.
+ */
+static void dcache_insert(folder_inode_t* parent, const char* name, uint32_t len,
+        uint32_t hash, tnode_t* tnode) {
+    if (dcache_entries >= DCACHE_MAX_ENTRIES) {
+        dcache_flush();
+    }
+
+    uint32_t bucket = dcache_bucket(parent, hash);
+    dentry_t* dent = kmem_cache_alloc(dentry_cache);
+
+    *dent = (dentry_t) {
+        .parent = parent,
+        .hash = hash,
+        .name_len = len,
+        .name = strndup(name, len),
+        .tnode = tnode,
+        .next = dcache[bucket]
+    };
+
+    dcache[bucket] = dent;
+    dcache_entries++;
+}
+
+/* Forgets about `name` in `parent`, which was just created or removed.
+ */
+static void dcache_invalidate(folder_inode_t* parent, const char* name) {
+    uint32_t len = strlen(name);
+    uint32_t hash = dcache_hash(name, len);
+    dentry_t** link = &dcache[dcache_bucket(parent, hash)];
+
+    while (*link) {
+        dentry_t* dent = *link;
+
+        if (dent->parent == parent && dent->hash == hash && dent->name_len == len &&
+                !strncmp(dent->name, name, len)) {
+            *link = dent->next;
+            kfree(dent->name);
+            kmem_cache_free(dentry_cache, dent);
+            dcache_entries--;
+            return;
+        }
+
+        link = &dent->next;
+    }
 }
 
 void delete_tnode(tnode_t* tn) {
@@ -47,7 +201,8 @@ void delete_tnode(tnode_t* tn) {
 
     kfree(in);
     kfree(tn->name);
-    kfree(tn);
+    kmem_cache_free(tnode_cache, tn);
+    dcache_flush();
 }
 
 /* Builds one level of vfs nodes with the children of the given inode.
@@ -59,12 +214,12 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
     uint32_t offset = 0;
 
     /* Add "." and ".." ourselves, don't trust the fs */
-    tnode_t* tn = kmalloc(sizeof(tnode_t));
+    tnode_t* tn = kmem_cache_alloc(tnode_cache);
     tn->inode = (inode_t*) inode;
     tn->name = strdup(".");
     list_add(&inode->subfolders, tn);
 
-    tn = kmalloc(sizeof(tnode_t));
+    tn = kmem_cache_alloc(tnode_cache);
     tn->inode = parent;
     tn->name = strdup("..");
     list_add(&inode->subfolders, tn);
@@ -74,7 +229,7 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
         offset += dent->entry_size;
 
         if (strncmp(dent->name, ".", dent->name_len_low) && strncmp(dent->name, "..", dent->name_len_low)) {
-            tn = kmalloc(sizeof(tnode_t));
+            tn = kmem_cache_alloc(tnode_cache);
             tn->name = strndup(dent->name, dent->name_len_low);
             tn->inode = FS(inode)->get_fs_inode(FS(inode), dent->inode);
             list_add(dent->type == DENT_FILE ? &inode->subfiles : &inode->subfolders, tn);
@@ -84,6 +239,45 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
     }
 
     inode->dirty = false;
+    inode->version++;
+}
+
+/* Searches the directory `inode` for the entry `part` of length `part_len`,
+ * through the dentry cache.
+ */
+static tnode_t* fs_lookup(folder_inode_t* inode, const char* part, uint32_t part_len) {
+    uint32_t hash = dcache_hash(part, part_len);
+    dentry_t* dent = dcache_lookup(inode, part, part_len, hash);
+
+    if (dent) {
+        return dent->tnode;
+    }
+
+    // Search the tree, starting with subfolders
+    tnode_t* found = NULL;
+    tnode_t* ent;
+    list_for_each_entry(ent, &inode->subfolders) {
+        if (strlen(ent->name) == part_len &&
+                !strncmp(ent->name, part, part_len)) {
+            found = ent;
+            break;
+        }
+    }
+
+    // Not a subfolder: check the subfiles
+    if (!found) {
+        list_for_each_entry(ent, &inode->subfiles) {
+            if (strlen(ent->name) == part_len &&
+                    !strncmp(ent->name, part, part_len)) {
+                found = ent;
+                break;
+            }
+        }
+    }
+
+    dcache_insert(inode, part, part_len, hash, found);
+
+    return found;
 }
 
 /* Returns an inode_t* from a path.
@@ -93,24 +287,28 @@ void fs_build_tree_level(folder_inode_t* inode, inode_t* parent) {
  * TODO: prevent creating duplicate entries.
  */
 inode_t* fs_open(const char* path, uint32_t flags) {
-    char* npath = fs_normalize_path(path);
+    char npath[MAX_PATH];
 
-    if (!strcmp(npath, "/")) {
-        kfree(npath);
-        return root->inode;
+    if (!fs_normalize_path(path, npath)) {
+        return NULL;
     }
 
     tnode_t* tnode = root;
     tnode_t* prev_tnode = NULL;
-    char* part = npath;
-    uint32_t part_len = 0;
+    uint32_t part_len;
+    const char* part = fs_path_next(npath, &part_len);
+
+    if (!part) {
+        return root->inode;
+    }
+
     bool last_part = false;
 
     while (!last_part && tnode != prev_tnode) {
         folder_inode_t* inode = (folder_inode_t*) tnode->inode;
         prev_tnode = tnode;
-        part += part_len + 1; // Skip the separator
-        part_len = strchrnul(part, '/') - part;
+
+        // Normalized paths only end with a null-terminated component
         last_part = part[part_len] == '\0';
 
         // File creation requested: now's the time
@@ -119,10 +317,12 @@ inode_t* fs_open(const char* path, uint32_t flags) {
                 flags & O_CREAT ? DENT_FILE : DENT_DIRECTORY,
                 inode->ino.inode_no);
 
-            tnode_t* new_tn = kmalloc(sizeof(tnode_t));
+            tnode_t* new_tn = kmem_cache_alloc(tnode_cache);
             new_tn->inode = FS(inode)->get_fs_inode(FS(inode), new_ino);
             new_tn->name = strdup(part);
             list_add(flags & O_CREAT ? &inode->subfiles : &inode->subfolders, new_tn);
+            dcache_invalidate(inode, part);
+            inode->version++;
         }
 
         // Build the tree as needed
@@ -130,37 +330,25 @@ inode_t* fs_open(const char* path, uint32_t flags) {
             fs_build_tree_level(inode, prev_tnode->inode);
         }
 
-        // Search the tree, starting with subfolders
-        tnode_t* ent;
-        list_for_each_entry(ent, &inode->subfolders) {
-            if (strlen(ent->name) == part_len &&
-                    !strncmp(ent->name, part, part_len)) {
-                tnode = ent;
-
-                if (((folder_inode_t*) tnode->inode)->dirty) {
-                    fs_build_tree_level((folder_inode_t*) tnode->inode, prev_tnode->inode);
-                }
+        tnode_t* ent = fs_lookup(inode, part, part_len);
 
-                break;
-            }
+        // Only directories can have children
+        if (!ent || (!last_part && ent->inode->type != DENT_DIRECTORY)) {
+            break;
         }
 
-        if (tnode != prev_tnode) {
-            continue;
+        tnode = ent;
+
+        if (tnode->inode->type == DENT_DIRECTORY &&
+                ((folder_inode_t*) tnode->inode)->dirty) {
+            fs_build_tree_level((folder_inode_t*) tnode->inode, prev_tnode->inode);
         }
 
-        // Not a subfolder: check the subfiles
-        list_for_each_entry(ent, &inode->subfiles) {
-            if (strlen(ent->name) == part_len &&
-                    !strncmp(ent->name, part, part_len)) {
-                tnode = ent;
-                break;
-            }
+        if (!last_part) {
+            part = fs_path_next(part + part_len, &part_len);
         }
     }
 
-    kfree(npath);
-
     return tnode != prev_tnode ? tnode->inode : NULL;
 }
 
@@ -170,9 +358,10 @@ inode_t* fs_open(const char* path, uint32_t flags) {
 void fs_mount(const char* mount_point, fs_t* fs) {
     /* Special case for the first filesystem mounted */
     if (!root && !strcmp(mount_point, "/")) {
-        root = kmalloc(sizeof(tnode_t));
+        root = kmem_cache_alloc(tnode_cache);
         root->inode = (inode_t*) fs->root;
         root->name = strdup("/");
+        list_add(&mounts, fs);
         return;
     }
 
@@ -199,15 +388,18 @@ void fs_mount(const char* mount_point, fs_t* fs) {
     while (!list_empty(&mnt_in->subfolders)) {
         tnode_t* tn = list_first_entry(&mnt_in->subfolders, tnode_t);
         kfree(tn->name);
-        kfree(tn);
+        kmem_cache_free(tnode_cache, tn);
         list_del(list_first(&mnt_in->subfolders));
     }
 
     // TODO: make umount possible
+    dcache_flush();
     mnt_in->ino = fs->root->ino;
     mnt_in->dirty = true;
     mnt_in->subfiles = LIST_HEAD_INIT(mnt_in->subfiles);
     mnt_in->subfolders = LIST_HEAD_INIT(mnt_in->subfolders);
+    mnt_in->version++;
+    list_add(&mounts, fs);
 }
 
 uint32_t fs_mkdir(const char* path, uint32_t mode) {
@@ -225,15 +417,24 @@ uint32_t fs_mkdir(const char* path, uint32_t mode) {
 
 int32_t fs_unlink(const char* path) {
     /* Check that we're unlinking a file */
-    char* npath = fs_normalize_path(path);
-    folder_inode_t* d_in = (folder_inode_t*) fs_open(dirname(npath), O_RDONLY);
+    char npath[MAX_PATH];
+    char dpath[MAX_PATH];
+
+    if (!fs_normalize_path(path, npath)) {
+        return -1;
+    }
+
+    folder_inode_t* d_in = (folder_inode_t*) fs_open(dirname(npath, dpath), O_RDONLY);
     inode_t* in = fs_open(npath, O_RDONLY);
-    kfree(npath);
 
     if (!d_in || !in || in->type != DENT_FILE) {
         return -1;
     }
 
+    /* Its inode number may be reused */
+    image_invalidate(in);
+    page_cache_invalidate(in);
+
     /* Ask the filesystem to unlink that inode */
     int32_t ret = FS(d_in)->unlink(FS(d_in), d_in->ino.inode_no, in->inode_no);
 
@@ -246,14 +447,16 @@ int32_t fs_unlink(const char* path) {
     tnode_t* tn;
     list_for_each(iter, tn, &d_in->subfiles) {
         if (tn->inode->inode_no == in->inode_no) {
+            dcache_invalidate(d_in, tn->name);
             kfree(tn->name);
-            kfree(tn);
+            kmem_cache_free(tnode_cache, tn);
 
             if (--in->hardlinks == 0) {
                 kfree(in);
             }
 
             list_del(iter);
+            d_in->version++;
             break;
         }
     }
@@ -295,16 +498,20 @@ int32_t fs_rename(const char* oldp, const char* newp) {
     }
 
     /* Do the renaming on the fs */
-    char* noldp = fs_normalize_path(oldp);
-    char* nnewp = fs_normalize_path(newp);
-    folder_inode_t* src = (folder_inode_t*) fs_open(dirname(noldp), O_RDONLY);
-    folder_inode_t* dst = (folder_inode_t*) fs_open(dirname(nnewp), O_RDONLY);
+    char noldp[MAX_PATH];
+    char nnewp[MAX_PATH];
+    char dpath[MAX_PATH];
+
+    if (!fs_normalize_path(oldp, noldp) || !fs_normalize_path(newp, nnewp)) {
+        return -1;
+    }
+
+    folder_inode_t* src = (folder_inode_t*) fs_open(dirname(noldp, dpath), O_RDONLY);
+    folder_inode_t* dst = (folder_inode_t*) fs_open(dirname(nnewp, dpath), O_RDONLY);
 
     int32_t ret = FS(old)->rename(FS(old), src->ino.inode_no, old->inode_no, dst->ino.inode_no);
 
     if (ret == -1) {
-        kfree(noldp);
-        kfree(nnewp);
         return -1;
     }
 
@@ -316,19 +523,20 @@ int32_t fs_rename(const char* oldp, const char* newp) {
     list_for_each(iter, tn, to_iterate) {
         if (tn->inode->inode_no == old->inode_no) {
             list_del(iter);
+            src->version++;
             break;
         }
     }
 
     /* Add to the destination parent directory */
+    dcache_invalidate(src, tn->name);
     kfree(tn->name);
     tn->name = strdup(basename(nnewp));
+    dcache_invalidate(dst, tn->name);
     list_t* to_add_to = old->type == DENT_DIRECTORY ?
         &dst->subfolders : &dst->subfiles;
     list_add(to_add_to, tn);
-
-    kfree(noldp);
-    kfree(nnewp);
+    dst->version++;
 
     return 0;
 }
@@ -353,18 +561,62 @@ uint32_t fs_read(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size) {
     return FS(in)->read(FS(in), in->inode_no, offset, buf, size);
 }
 
-uint32_t fs_write(inode_t* in, uint8_t* buf, uint32_t size) {
+/* Writes `size` bytes from `buf` at `offset` in the file. Filesystems that
+ * can't write at an offset, such as pipes, append instead.
+ * Returns the number of bytes written.
+ */
+uint32_t fs_write(inode_t* in, uint32_t offset, uint8_t* buf, uint32_t size) {
     if (!in) {
         return 0;
     }
 
-    uint32_t written = FS(in)->append(FS(in), in->inode_no, buf, size);
-    in->size += written;
+    // Running instances keep the version they loaded
+    image_invalidate(in);
+
+    if (!FS(in)->write_at) {
+        uint32_t written = FS(in)->append(FS(in), in->inode_no, buf, size);
+        in->size += written;
+
+        return written;
+    }
+
+    uint32_t written = FS(in)->write_at(FS(in), in->inode_no, offset, buf, size);
+    page_cache_write(in, offset, buf, written);
+
+    if (offset + written > in->size) {
+        in->size = offset + written;
+    }
 
     return written;
 }
 
-uint32_t fs_readdir(inode_t* in, uint32_t index, sos_directory_entry_t* d_ent, uint32_t size) {
+/* Sets the size of the file to `size` bytes, dropping the data past it or
+ * extending it with zeros.
+ */
+int32_t fs_truncate(inode_t* in, uint32_t size) {
+    if (!in || in->type != DENT_FILE || !FS(in)->truncate) {
+        return -1;
+    }
+
+    image_invalidate(in);
+
+    int32_t ret = FS(in)->truncate(FS(in), in->inode_no, size);
+
+    if (ret == 0) {
+        in->size = size;
+        page_cache_truncate(in, size);
+    }
+
+    return ret;
+}
+
+/* Writes the entry of the directory `in` at `cursor` to `d_ent`, `size` bytes
+ * large, and moves the cursor to the next entry. Returns the size of the entry
+ * or zero if there are no more entries, or if it doesn't fit.
+ * Cursors made stale by changes to the directory are repositioned from their
+ * index.
+ */
+uint32_t fs_readdir(inode_t* in, dir_cursor_t* cursor, sos_directory_entry_t* d_ent, uint32_t size) {
     if (in->type != DENT_DIRECTORY) {
         printke("not a directory");
         return 0;
@@ -377,98 +629,144 @@ uint32_t fs_readdir(inode_t* in, uint32_t index, sos_directory_entry_t* d_ent, u
         return 0;
     }
 
-    uint32_t i = 0;
-    tnode_t* tn;
-    list_for_each_entry(tn, &fin->subfolders) {
-        if (i++ == index) {
-            return tnode_to_directory_entry(tn, d_ent, size);
+    // Subfolders come first, then subfiles
+    if (!cursor->node || cursor->version != fin->version) {
+        cursor->node = fin->subfolders.next;
+        cursor->version = fin->version;
+
+        for (uint32_t i = 0; i < cursor->index; i++) {
+            if (cursor->node == &fin->subfolders) {
+                cursor->node = fin->subfiles.next;
+            }
+
+            if (cursor->node == &fin->subfiles) {
+                break;
+            }
+
+            cursor->node = cursor->node->next;
         }
     }
 
-    list_for_each_entry(tn, &fin->subfiles) {
-        if (i++ == index) {
-            return tnode_to_directory_entry(tn, d_ent, size);
-        }
+    if (cursor->node == &fin->subfolders) {
+        cursor->node = fin->subfiles.next;
     }
 
-    return 0;
-}
+    if (cursor->node == &fin->subfiles) {
+        return 0;
+    }
 
-/* Returns the absolute version of `p`, free of oddities,
- * dynamically allocated.
- * TODO: make it use static memory.
- */
-char* fs_normalize_path(const char* p) {
-    char* np = kmalloc(MAX_PATH);
-    strcpy(np, p);
+    uint32_t written = tnode_to_directory_entry(list_entry(cursor->node, tnode_t), d_ent, size);
 
-    if (!strcmp(np, "/")) {
-        return np;
+    if (written) {
+        cursor->node = cursor->node->next;
+        cursor->index++;
     }
 
-    if (!strcmp(np, ".")) {
-        return proc_get_cwd();
-    }
+    return written;
+}
 
-    // Make the path absolute
-    if (p[0] != '/') {
-        char* cwd = proc_get_cwd();
-        strcpy(np, cwd);
-        strcat(np, "/");
-        strcat(np, p);
-        kfree(cwd);
+/* Returns the component of the path `p` starting at or after `p`, skipping
+ * separators, and writes its length to `len`. Returns NULL if there is none
+ * left. The next component starts at or after the returned pointer + `len`.
+ * Components aren't null-terminated, except the last one.
+ */
+const char* fs_path_next(const char* p, uint32_t* len) {
+    while (*p == '/') {
+        p++;
     }
 
-    // Trim trailing slashes
-    while (np[strlen(np) - 1] == '/') {
-        np[strlen(np) - 1] = '\0';
+    if (*p == '\0') {
+        return NULL;
     }
 
-    // Trim '//' sequences
-    char* s = NULL;
-    while ((s = strstr(np, "//"))) {
-        uint32_t n = 0;
+    *len = strchrnul(p, '/') - p;
+
+    return p;
+}
 
-        // Make sure to keep exaclty one /
-        if (strstr(np, "///") != s) {
-            n = 1;
-        } else {
-            n = 2;
+/* Appends the components of `p` to the normalized path of length `len` in
+ * `buf`, resolving "." and "..", and returns the new length.
+ * Returns -1 if the result doesn't fit in `MAX_PATH` bytes.
+ */
+static int32_t fs_append_path(char* buf, int32_t len, const char* p) {
+    uint32_t part_len;
+    const char* part = fs_path_next(p, &part_len);
+
+    while (part) {
+        if (part_len == 2 && part[0] == '.' && part[1] == '.') {
+            // Go up, but not above the root
+            while (len > 0 && buf[len - 1] != '/') {
+                len--;
+            }
+
+            if (len > 1) {
+                len--;
+            }
+        } else if (part_len != 1 || part[0] != '.') {
+            if (len + part_len + 2 > MAX_PATH) {
+                return -1;
+            }
+
+            if (len > 1) {
+                buf[len++] = '/';
+            }
+
+            memcpy(buf + len, part, part_len);
+            len += part_len;
         }
 
-        char* npp = kmalloc(MAX_PATH);
-        strncpy(npp, np, s - np);
-        npp[s - np] = '\0';
-        strcat(npp, s + n);
-        kfree(np);
-        np = npp;
+        part = fs_path_next(part + part_len, &part_len);
+    }
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* Writes the absolute, normalized form of `p` to `buf`, which must hold
+ * `MAX_PATH` bytes. Relative paths start from the current working directory,
+ * and the result has no "." or ".." components, repeated or trailing
+ * separators. Doesn't allocate memory.
+ * Returns false if the result doesn't fit in `buf`.
+ */
+bool fs_normalize_path(const char* p, char* buf) {
+    int32_t len = 1;
+
+    buf[0] = '/';
+    buf[1] = '\0';
+
+    if (p[0] != '/' && proc_get_current_pid()) {
+        len = fs_append_path(buf, len, proc_peek_cwd());
+    }
+
+    if (len >= 0) {
+        len = fs_append_path(buf, len, p);
     }
 
-    return np;
+    return len >= 0;
 }
 
-/* Returns the path to the parent directory of the thing pointed to by `p`,
- * statically allocated.
+/* Writes the path to the parent directory of the thing pointed to by `p` to
+ * `buf`, and returns it.
  * Expects `p` to be a normalized path.
  * TODO: repurpose those functions in libc.
  */
-char* dirname(const char* p) {
-    static char dp[MAX_PATH] = "";
+char* dirname(const char* p, char* buf) {
     char* last_sep = strrchr(p, '/');
 
-    strcpy(dp, p);
+    strcpy(buf, p);
 
-    if (!strcmp(dp, "/")) {
-        return dp;
+    if (!strcmp(buf, "/")) {
+        return buf;
     }
 
     if (last_sep == p) {
-        dp[1] = '\0';
+        buf[1] = '\0';
     } else {
-        dp[last_sep - p] = '\0';
+        buf[last_sep - p] = '\0';
     }
 
-    return dp;
+    return buf;
 }
 
 /* Returns the name of the file pointed to by `p`.
@@ -487,7 +785,8 @@ char* basename(const char* p) {
  * If `size` is too small, does nothing and returns 0.
  */
 uint32_t tnode_to_directory_entry(tnode_t* tn, sos_directory_entry_t* d_ent, uint32_t size) {
-    uint32_t esize = sizeof(sos_directory_entry_t) + strlen(tn->name) + 1;
+    // Keep packed entries aligned, see `proc_getdents`
+    uint32_t esize = align_to(sizeof(sos_directory_entry_t) + strlen(tn->name) + 1, 4);
 
     if (size < esize) {
         return 0;
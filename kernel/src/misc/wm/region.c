@@ -0,0 +1,378 @@
+#include <kernel/wm.h>
+#include <kernel/sys.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Regions are sets of pixels, stored as lists of rectangles in the "YX-banded"
+ * form of pixman and X11: rectangles are sorted by their top edge, then by
+ * their left edge. Rectangles with the same top edge form a band: they also
+ * share their bottom edge, and don't touch each other. Bands don't overlap,
+ * and vertically adjacent bands spanning the same columns are merged.
+ * This makes the representation of a region unique, and operations on regions
+ * linear in their number of rectangles.
+ */
+
+/* Small rectangle arrays come from a cache of that many rectangles, so that
+ * regions are cheap to build and throw away on every draw.
+ */
+#define REGION_POOL_RECTS 32
+
+typedef enum region_op_t {
+    REGION_UNION,
+    REGION_SUBTRACT,
+    REGION_INTERSECT
+} region_op_t;
+
+static kmem_cache_t* rects_cache = NULL;
+
+void region_init(region_t* reg) {
+    *reg = (region_t) {
+        .count = 0,
+        .capacity = 0,
+        .rects = NULL
+    };
+}
+
+static void region_free_rects(region_t* reg) {
+    if (reg->capacity == REGION_POOL_RECTS) {
+        kmem_cache_free(rects_cache, reg->rects);
+    } else if (reg->capacity) {
+        kfree(reg->rects);
+    }
+}
+
+void region_fini(region_t* reg) {
+    region_free_rects(reg);
+    region_init(reg);
+}
+
+/* Makes room for `num` rectangles in `reg`.
+ */
+static void region_reserve(region_t* reg, uint32_t num) {
+    if (num <= reg->capacity) {
+        return;
+    }
+
+    if (!rects_cache) {
+        rects_cache = kmem_cache_create("region_rects", REGION_POOL_RECTS*sizeof(rect_t), 0);
+    }
+
+    uint32_t capacity = REGION_POOL_RECTS;
+    rect_t* rects;
+
+    if (num > REGION_POOL_RECTS) {
+        capacity = max(num, 2*reg->capacity);
+        rects = kmalloc(capacity*sizeof(rect_t));
+    } else {
+        rects = kmem_cache_alloc(rects_cache);
+    }
+
+    memcpy(rects, reg->rects, reg->count*sizeof(rect_t));
+    region_free_rects(reg);
+    reg->rects = rects;
+    reg->capacity = capacity;
+}
+
+static void region_append(region_t* reg, int32_t top, int32_t left, int32_t bottom, int32_t right) {
+    region_reserve(reg, reg->count + 1);
+
+    reg->rects[reg->count++] = (rect_t) {
+        .top = top, .left = left, .bottom = bottom, .right = right
+    };
+}
+
+static bool rect_empty(rect_t rect) {
+    return rect.top > rect.bottom || rect.left > rect.right;
+}
+
+void region_init_rect(region_t* reg, rect_t rect) {
+    region_init(reg);
+
+    if (!rect_empty(rect)) {
+        region_append(reg, rect.top, rect.left, rect.bottom, rect.right);
+    }
+}
+
+void region_copy(region_t* dst, const region_t* src) {
+    if (dst == src) {
+        return;
+    }
+
+    dst->count = 0;
+    region_reserve(dst, src->count);
+    memcpy(dst->rects, src->rects, src->count*sizeof(rect_t));
+    dst->count = src->count;
+}
+
+/* Returns the index of the first rectangle after the band starting at `i`.
+ */
+static uint32_t region_band_end(const region_t* reg, uint32_t i) {
+    uint32_t end = i;
+
+    while (end < reg->count && reg->rects[end].top == reg->rects[i].top) {
+        end++;
+    }
+
+    return end;
+}
+
+/* Merges the last band of `reg`, starting at `band`, into the previous one,
+ * starting at `prev`, if the former extends the latter downwards.
+ * Returns the start of the last band of `reg`.
+ */
+static uint32_t region_coalesce(region_t* reg, uint32_t prev, uint32_t band) {
+    uint32_t num = reg->count - band;
+
+    if (!num) {
+        return prev;
+    }
+
+    if (prev == band || band - prev != num
+            || reg->rects[prev].bottom + 1 != reg->rects[band].top) {
+        return band;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        if (reg->rects[prev + i].left != reg->rects[band + i].left
+                || reg->rects[prev + i].right != reg->rects[band + i].right) {
+            return band;
+        }
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        reg->rects[prev + i].bottom = reg->rects[band + i].bottom;
+    }
+
+    reg->count = band;
+
+    return prev;
+}
+
+/* The following functions combine the columns spanned by the `na` rects of
+ * `a` and the `nb` rects of `b`, each sorted and disjoint, and append the
+ * result to `out` as a band from `top` to `bottom`.
+ */
+
+static void region_union_spans(region_t* out, const rect_t* a, uint32_t na,
+        const rect_t* b, uint32_t nb, int32_t top, int32_t bottom) {
+    bool open = false;
+    int32_t left = 0;
+    int32_t right = 0;
+
+    while (na || nb) {
+        const rect_t* r;
+
+        if (!nb || (na && a->left < b->left)) {
+            r = a++;
+            na--;
+        } else {
+            r = b++;
+            nb--;
+        }
+
+        if (open && r->left <= right + 1) {
+            right = max(right, r->right);
+            continue;
+        }
+
+        if (open) {
+            region_append(out, top, left, bottom, right);
+        }
+
+        left = r->left;
+        right = r->right;
+        open = true;
+    }
+
+    if (open) {
+        region_append(out, top, left, bottom, right);
+    }
+}
+
+static void region_subtract_spans(region_t* out, const rect_t* a, uint32_t na,
+        const rect_t* b, uint32_t nb, int32_t top, int32_t bottom) {
+    for (; na; a++, na--) {
+        int32_t left = a->left;
+
+        // Spans of `b` left of this one are left of the next ones too
+        while (nb && b->right < left) {
+            b++;
+            nb--;
+        }
+
+        for (uint32_t i = 0; i < nb && b[i].left <= a->right; i++) {
+            if (b[i].left > left) {
+                region_append(out, top, left, bottom, b[i].left - 1);
+            }
+
+            left = max(left, b[i].right + 1);
+        }
+
+        if (left <= a->right) {
+            region_append(out, top, left, bottom, a->right);
+        }
+    }
+}
+
+static void region_intersect_spans(region_t* out, const rect_t* a, uint32_t na,
+        const rect_t* b, uint32_t nb, int32_t top, int32_t bottom) {
+    while (na && nb) {
+        int32_t left = max(a->left, b->left);
+        int32_t right = min(a->right, b->right);
+
+        if (left <= right) {
+            region_append(out, top, left, bottom, right);
+        }
+
+        if (a->right < b->right) {
+            a++;
+            na--;
+        } else {
+            b++;
+            nb--;
+        }
+    }
+}
+
+/* Computes `a op b` into `dst`, which may be `a` or `b`.
+ * Both regions are swept from top to bottom, in slices where the bands of
+ * each region don't change. Each slice gives at most one band of the result.
+ */
+static void region_op(region_t* dst, const region_t* a, const region_t* b, region_op_t op) {
+    region_t out;
+    region_init(&out);
+
+    uint32_t ia = 0;
+    uint32_t ib = 0;
+    uint32_t prev = 0;
+    int32_t y = INT32_MIN;
+
+    while (ia < a->count || ib < b->count) {
+        if (op == REGION_INTERSECT && (ia == a->count || ib == b->count)) {
+            break;
+        }
+
+        if (op == REGION_SUBTRACT && ia == a->count) {
+            break;
+        }
+
+        bool in_a = ia < a->count && a->rects[ia].top <= y;
+        bool in_b = ib < b->count && b->rects[ib].top <= y;
+
+        // Skip to the next band
+        if (!in_a && !in_b) {
+            y = INT32_MAX;
+
+            if (ia < a->count) {
+                y = a->rects[ia].top;
+            }
+
+            if (ib < b->count) {
+                y = min(y, b->rects[ib].top);
+            }
+
+            continue;
+        }
+
+        // The slice ends where a band ends or starts
+        int32_t bottom = INT32_MAX;
+
+        if (ia < a->count) {
+            bottom = in_a ? a->rects[ia].bottom : a->rects[ia].top - 1;
+        }
+
+        if (ib < b->count) {
+            bottom = min(bottom, in_b ? b->rects[ib].bottom : b->rects[ib].top - 1);
+        }
+
+        uint32_t ea = in_a ? region_band_end(a, ia) : ia;
+        uint32_t eb = in_b ? region_band_end(b, ib) : ib;
+        uint32_t band = out.count;
+        const rect_t* ra = a->rects + ia;
+        const rect_t* rb = b->rects + ib;
+
+        if (op == REGION_UNION) {
+            region_union_spans(&out, ra, ea - ia, rb, eb - ib, y, bottom);
+        } else if (op == REGION_SUBTRACT) {
+            region_subtract_spans(&out, ra, ea - ia, rb, eb - ib, y, bottom);
+        } else {
+            region_intersect_spans(&out, ra, ea - ia, rb, eb - ib, y, bottom);
+        }
+
+        prev = region_coalesce(&out, prev, band);
+        y = bottom + 1;
+
+        if (in_a && a->rects[ia].bottom == bottom) {
+            ia = ea;
+        }
+
+        if (in_b && b->rects[ib].bottom == bottom) {
+            ib = eb;
+        }
+    }
+
+    region_fini(dst);
+    *dst = out;
+}
+
+void region_union(region_t* dst, const region_t* a, const region_t* b) {
+    region_op(dst, a, b, REGION_UNION);
+}
+
+void region_subtract(region_t* dst, const region_t* a, const region_t* b) {
+    region_op(dst, a, b, REGION_SUBTRACT);
+}
+
+void region_intersect(region_t* dst, const region_t* a, const region_t* b) {
+    region_op(dst, a, b, REGION_INTERSECT);
+}
+
+/* Returns whether `rect` is empty or entirely above or below `reg`.
+ */
+static bool region_misses_rect(const region_t* reg, rect_t rect) {
+    return !reg->count || rect_empty(rect) || rect.bottom < reg->rects[0].top
+        || rect.top > reg->rects[reg->count - 1].bottom;
+}
+
+/* The following functions combine `reg` with a single rectangle, without
+ * allocating it a region of its own.
+ */
+
+void region_union_rect(region_t* reg, rect_t rect) {
+    region_t r = { .count = 1, .capacity = 0, .rects = &rect };
+
+    if (!rect_empty(rect)) {
+        region_op(reg, reg, &r, REGION_UNION);
+    }
+}
+
+void region_subtract_rect(region_t* reg, rect_t rect) {
+    region_t r = { .count = 1, .capacity = 0, .rects = &rect };
+
+    if (!region_misses_rect(reg, rect)) {
+        region_op(reg, reg, &r, REGION_SUBTRACT);
+    }
+}
+
+void region_intersect_rect(region_t* reg, rect_t rect) {
+    region_t r = { .count = 1, .capacity = 0, .rects = &rect };
+
+    if (region_misses_rect(reg, rect)) {
+        reg->count = 0;
+    } else {
+        region_op(reg, reg, &r, REGION_INTERSECT);
+    }
+}
+
+/* Moves every pixel of `reg` by `dx` to the right and `dy` to the bottom.
+ */
+void region_translate(region_t* reg, int32_t dx, int32_t dy) {
+    for (uint32_t i = 0; i < reg->count; i++) {
+        reg->rects[i].top += dy;
+        reg->rects[i].left += dx;
+        reg->rects[i].bottom += dy;
+        reg->rects[i].right += dx;
+    }
+}
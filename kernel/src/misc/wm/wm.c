@@ -1,6 +1,9 @@
 #include <kernel/wm.h>
 #include <kernel/mouse.h>
 #include <kernel/kbd.h>
+#include <kernel/proc.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
 #include <kernel/sys.h>
 
 #include <kernel/fs.h>
@@ -15,16 +18,21 @@
 
 void wm_draw_window(wm_window_t* win, rect_t rect);
 void wm_partial_draw_window(wm_window_t* win, rect_t rect);
+void wm_blit_region(const region_t* reg, int32_t dx, int32_t dy);
 void wm_refresh_screen();
 void wm_refresh_partial(rect_t clip);
 void wm_assign_position(wm_window_t* win);
 void wm_assign_z_orders();
+void wm_update_visible();
 void wm_raise_window(wm_window_t* win);
+void wm_move_window(wm_window_t* win, int32_t x, int32_t y);
 list_t* wm_get_window(uint32_t id);
 void wm_print_windows();
-list_t* wm_get_windows_above(wm_window_t* win);
 rect_t wm_mouse_to_rect(mouse_t mouse);
-void wm_draw_mouse(rect_t new);
+void wm_init_cursor();
+void wm_show_cursor();
+bool wm_hide_cursor(rect_t clip);
+void wm_move_cursor();
 void wm_mouse_callback(mouse_t curr);
 void wm_kbd_callback(kbd_event_t event);
 
@@ -36,22 +44,97 @@ static wm_window_t* focused;
 static uint32_t id_count = 0;
 static fb_t fb;
 static mouse_t mouse;
+static region_t desktop; // Part of the screen not covered by any window
+
+/* Shared surfaces of closed windows that other processes still map. They're
+ * freed once no process does anymore, see `wm_release_surfaces`.
+ */
+typedef struct wm_surface_t {
+    uintptr_t address;
+    uint32_t size;
+} wm_surface_t;
+
+static list_t kept_surfaces;
+
+/* The cursor is drawn over the framebuffer, the pixels it covers being saved
+ * so that moving it doesn't require drawing windows again. Anything drawing
+ * to the framebuffer under the cursor must hide it first.
+ */
+static const char* cursor_shape[MOUSE_SIZE] = {
+    "X               ",
+    "XX              ",
+    "X.X             ",
+    "X..X            ",
+    "X...X           ",
+    "X....X          ",
+    "X.....X         ",
+    "X......X        ",
+    "X.......X       ",
+    "X........X      ",
+    "X.....XXXXo     ",
+    "X..X..Xoooo     ",
+    "X.XoX..X        ",
+    "XXooX..Xo       ",
+    "Xoo  X..X       ",
+    " o    XXoo      ",
+};
+
+static uint32_t cursor_image[MOUSE_SIZE*MOUSE_SIZE]; // ARGB
+static uint32_t cursor_under[MOUSE_SIZE*MOUSE_SIZE];
+static rect_t cursor_rect; // Where the cursor was drawn
+static bool cursor_shown = false;
 
 void init_wm() {
     fb = fb_get_info();
     windows = LIST_HEAD_INIT(windows);
+    kept_surfaces = LIST_HEAD_INIT(kept_surfaces);
 
     mouse.x = fb.width/2;
     mouse.y = fb.height/2;
 
+    region_init(&desktop);
+    wm_update_visible();
+    wm_init_cursor();
+    wm_show_cursor();
+
     mouse_set_callback(wm_mouse_callback);
     kbd_set_callback(wm_kbd_callback);
 }
 
 /* Associates a buffer with a window id. The calling program will then be able
  * to use this id to render the buffer through the window manager.
+ * If the buffer's address is zero, the window gets a shared surface instead,
+ * whose address in the calling process is written to `buff`.
+ * Returns zero if the surface couldn't be allocated or mapped.
  */
 uint32_t wm_open_window(fb_t* buff, uint32_t flags) {
+    uint32_t size = buff->height*buff->pitch;
+    void* surface;
+
+    // Shared surfaces get mapped in the client, so they take whole pages
+    if (!buff->address) {
+        size = align_to(size, 0x1000);
+        surface = aligned_alloc(0x1000, size);
+    } else {
+        surface = kmalloc(size);
+    }
+
+    if (!surface) {
+        return 0;
+    }
+
+    if (!buff->address) {
+        memset(surface, 0, size);
+        buff->address = (uintptr_t) proc_map_shared((uintptr_t) surface, size);
+
+        if (!buff->address) {
+            kfree(surface);
+            return 0;
+        }
+
+        flags |= WM_SHARED;
+    }
+
     wm_window_t* win = (wm_window_t*) kmalloc(sizeof(wm_window_t));
 
     *win = (wm_window_t) {
@@ -59,19 +142,80 @@ uint32_t wm_open_window(fb_t* buff, uint32_t flags) {
         .kfb = *buff,
         .id = ++id_count,
         .flags = flags | WM_NOT_DRAWN,
-        .events = ringbuffer_new(WM_EVENT_QUEUE_SIZE * sizeof(wm_event_t))
+        .events = ringbuffer_new(WM_EVENT_QUEUE_SIZE * sizeof(wm_event_t)),
+        .pid = proc_get_current_pid()
     };
 
-    win->kfb.address = (uintptr_t) kmalloc(buff->height*buff->pitch);
+    win->kfb.address = (uintptr_t) surface;
+    region_init(&win->visible);
 
     list_add_front(&windows, win);
     wm_assign_position(win);
     wm_assign_z_orders();
+    wm_update_visible();
     wm_raise_window(win);
 
     return win->id;
 }
 
+/* Returns whether a page of the surface at `address` is mapped by a process.
+ */
+static bool wm_surface_mapped(uintptr_t address, uint32_t size) {
+    for (uint32_t off = 0; off < size; off += 0x1000) {
+        if (pmm_page_shared(paging_virt_to_phys(address + off))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Frees the buffer of `win`. A shared surface is unmapped from its client if
+ * it's the one closing it, and kept allocated if it's still mapped elsewhere,
+ * e.g. in a forked process, until `wm_release_surfaces` finds it unmapped.
+ */
+static void wm_free_surface(wm_window_t* win) {
+    uint32_t size = align_to(win->kfb.height*win->kfb.pitch, 0x1000);
+
+    if (win->flags & WM_SHARED) {
+        if (win->pid == proc_get_current_pid()) {
+            proc_munmap(win->ufb.address, size);
+        }
+
+        if (wm_surface_mapped(win->kfb.address, size)) {
+            wm_surface_t* surface = kmalloc(sizeof(wm_surface_t));
+
+            *surface = (wm_surface_t) {
+                .address = win->kfb.address,
+                .size = size
+            };
+
+            list_add(&kept_surfaces, surface);
+            return;
+        }
+    }
+
+    kfree((void*) win->kfb.address);
+}
+
+/* Frees the surfaces of closed windows that no process maps anymore. Called
+ * when windows are closed and when processes drop their address space.
+ */
+void wm_release_surfaces() {
+    list_t* iter;
+    list_t* n;
+
+    list_for_each_safe(iter, n, &kept_surfaces) {
+        wm_surface_t* surface = list_entry(iter, wm_surface_t);
+
+        if (!wm_surface_mapped(surface->address, surface->size)) {
+            kfree((void*) surface->address);
+            kfree(surface);
+            list_del(iter);
+        }
+    }
+}
+
 void wm_close_window(uint32_t win_id) {
     list_t* item = wm_get_window(win_id);
 
@@ -80,8 +224,16 @@ void wm_close_window(uint32_t win_id) {
         rect_t rect = rect_from_window(win);
 
         list_del(item);
+        wm_update_visible();
+
+        if (focused == win) {
+            focused = NULL;
+        }
+
+        region_fini(&win->visible);
         ringbuffer_free(win->events);
-        kfree((void*) win->kfb.address);
+        wm_free_surface(win);
+        wm_release_surfaces();
         kfree((void*) win);
 
         if (!list_empty(&windows)) {
@@ -116,18 +268,24 @@ void wm_render_window(uint32_t win_id, rect_t* clip) {
         };
     }
 
-    // Copy the window's buffer in the kernel
-    uintptr_t off = clip->top*win->ufb.pitch + clip->left*win->ufb.bpp/8;
-    uint32_t len = (clip->right - clip->left + 1)*win->ufb.bpp/8;
+    // Copy the window's buffer in the kernel, if it isn't shared with it
+    if (!(win->flags & WM_SHARED)) {
+        uintptr_t off = clip->top*win->ufb.pitch + clip->left*win->ufb.bpp/8;
+        uint32_t len = (clip->right - clip->left + 1)*win->ufb.bpp/8;
 
-    for (int32_t i = clip->top; i <= clip->bottom; i++) {
-        memcpy((void*) (win->kfb.address + off), (void*) (win->ufb.address + off), len);
-        off += win->ufb.pitch;
+        for (int32_t i = clip->top; i <= clip->bottom; i++) {
+            memcpy((void*) (win->kfb.address + off), (void*) (win->ufb.address + off), len);
+            off += win->ufb.pitch;
+        }
     }
 
-    // Draw the window for real
-    rect = rect_from_window(win);
-    wm_draw_window(win, *clip);
+    // Draw the window for real, the clip being relative to the window
+    rect_t screen_clip = {
+        .top = win->y + clip->top, .left = win->x + clip->left,
+        .bottom = win->y + clip->bottom, .right = win->x + clip->right
+    };
+
+    wm_draw_window(win, screen_clip);
 
     // Mark as drawn once
     if (win->flags & WM_NOT_DRAWN) {
@@ -204,6 +362,7 @@ void wm_raise_window(wm_window_t* win) {
     }
 
     list_move(win_iter, topmost);
+    wm_update_visible();
 
     // Redraw if possible. Not sure this is this function's responsibility.
     if (!(win->flags & WM_NOT_DRAWN)) {
@@ -211,6 +370,64 @@ void wm_raise_window(wm_window_t* win) {
     }
 }
 
+/* Moves the window to (x, y). What was visible of it is moved on the
+ * framebuffer directly, so that only the parts of it that were hidden and
+ * the areas it uncovers are drawn again.
+ */
+void wm_move_window(wm_window_t* win, int32_t x, int32_t y) {
+    int32_t dx = x - win->x;
+    int32_t dy = y - win->y;
+    region_t old;
+    region_t moved;
+    region_t exposed;
+
+    rect_t old_rect = rect_from_window(win);
+    rect_t new_rect = {
+        .top = old_rect.top + dy, .left = old_rect.left + dx,
+        .bottom = old_rect.bottom + dy, .right = old_rect.right + dx
+    };
+
+    // Don't move the cursor's pixels along with the window's
+    bool hidden = wm_hide_cursor(old_rect) || wm_hide_cursor(new_rect);
+
+    region_init(&old);
+    region_init(&moved);
+    region_init(&exposed);
+    region_copy(&old, &win->visible);
+
+    win->x = x;
+    win->y = y;
+    wm_update_visible();
+
+    // Pixels that were visible and still are only need to be moved
+    region_copy(&moved, &old);
+    region_translate(&moved, dx, dy);
+    region_intersect(&moved, &moved, &win->visible);
+    wm_blit_region(&moved, dx, dy);
+
+    // Parts of the window coming into view are drawn from its buffer
+    region_subtract(&exposed, &win->visible, &moved);
+
+    for (uint32_t i = 0; i < exposed.count; i++) {
+        wm_partial_draw_window(win, exposed.rects[i]);
+    }
+
+    // What's under the window's former position is drawn again
+    region_subtract(&exposed, &old, &win->visible);
+
+    for (uint32_t i = 0; i < exposed.count; i++) {
+        wm_refresh_partial(exposed.rects[i]);
+    }
+
+    region_fini(&old);
+    region_fini(&moved);
+    region_fini(&exposed);
+
+    if (hidden) {
+        wm_show_cursor();
+    }
+}
+
 /* Sets the position of the window according to obscure rules.
  * TODO: revamp entirely.
  */
@@ -254,6 +471,31 @@ void wm_assign_z_orders() {
 
 /* Clipping stuff */
 
+/* Recomputes the visible region of every window, and the part of the screen
+ * left uncovered. This must be called whenever windows are opened, closed,
+ * moved or reordered; drawing then only clips against those regions.
+ */
+void wm_update_visible() {
+    list_t* iter;
+    wm_window_t* win;
+
+    rect_t screen_rect = {
+        .top = 0, .left = 0, .bottom = fb.height - 1, .right = fb.width - 1
+    };
+
+    region_fini(&desktop);
+    region_init_rect(&desktop, screen_rect);
+
+    // From the foremost window down, each gets what the previous ones left
+    list_for_each_entry_rev(iter, win, &windows) {
+        rect_t rect = rect_from_window(win);
+
+        region_copy(&win->visible, &desktop);
+        region_intersect_rect(&win->visible, rect);
+        region_subtract_rect(&desktop, rect);
+    }
+}
+
 /* Draw the given part of the window to the framebuffer.
  * Note that the given clip is allowed to be partially outside the window.
  */
@@ -289,71 +531,107 @@ void wm_partial_draw_window(wm_window_t* win, rect_t clip) {
     }
 }
 
-/* Draws the visible parts of the window that are within the given clipping
- * rect.
+/* Copies the pixels of the framebuffer found at `reg` translated by
+ * (-dx, -dy) to `reg`. Rows and rects are copied starting from the side
+ * the pixels are moving to, so that no source is overwritten before it's
+ * read.
  */
-void wm_draw_window(wm_window_t* win, rect_t rect) {
-    rect_t win_rect = rect_from_window(win);
-    list_t* clip_windows = wm_get_windows_above(win);
-    list_t clip_rects = LIST_HEAD_INIT(clip_rects);
+void wm_blit_region(const region_t* reg, int32_t dx, int32_t dy) {
+    const rect_t* rects = reg->rects;
+    const int32_t src_off = dy*(int32_t) fb.pitch + dx*(int32_t) fb.bpp/8;
+    uint32_t done = 0;
+
+    while (done < reg->count) {
+        uint32_t first;
+        uint32_t last;
+
+        // Find the next band, from the bottom if moving down
+        if (dy > 0) {
+            last = reg->count - done;
+            first = last - 1;
+
+            while (first > 0 && rects[first - 1].top == rects[first].top) {
+                first--;
+            }
+        } else {
+            first = done;
+            last = first + 1;
 
-    rect_add_clip_rect(&clip_rects, rect);
+            while (last < reg->count && rects[last].top == rects[first].top) {
+                last++;
+            }
+        }
 
-    // Convert covering windows to clipping rects
-    while (!list_empty(clip_windows)) {
-        wm_window_t* cw = list_first_entry(clip_windows, wm_window_t);
-        list_del(list_first(clip_windows));
-        rect_t clip = rect_from_window(cw);
-        rect_subtract_clip_rect(&clip_rects, clip);
-    }
+        done += last - first;
+
+        int32_t height = rects[first].bottom - rects[first].top + 1;
 
-    kfree(clip_windows);
+        for (int32_t n = 0; n < height; n++) {
+            int32_t y = dy > 0 ? rects[first].bottom - n : rects[first].top + n;
 
-    // Draw what's left
-    rect_t* clip;
-    list_for_each_entry(clip, &clip_rects) {
-        if (rect_intersect(*clip, win_rect)) {
-            wm_partial_draw_window(win, *clip);
+            for (uint32_t m = first; m < last; m++) {
+                const rect_t* r = &rects[dx > 0 ? first + last - 1 - m : m];
+                uintptr_t dst = fb.address + y*fb.pitch + r->left*fb.bpp/8;
+                uint32_t len = (r->right - r->left + 1)*fb.bpp/8;
+
+                memmove((void*) dst, (void*) (dst - src_off), len);
+            }
         }
     }
+}
+
+/* Draws the visible parts of the window that are within the given clipping
+ * rect.
+ */
+void wm_draw_window(wm_window_t* win, rect_t rect) {
+    rect_t* visible = win->visible.rects;
+    bool hidden = wm_hide_cursor(rect);
 
-    // Redraw the mouse
-    rect_t mouse_rect = wm_mouse_to_rect(mouse);
-    wm_draw_mouse(mouse_rect);
+    // Rects are sorted by their top edge, we can stop past the clip
+    for (uint32_t i = 0; i < win->visible.count && visible[i].top <= rect.bottom; i++) {
+        if (rect_intersect(visible[i], rect)) {
+            wm_partial_draw_window(win, rect_clip(visible[i], rect));
+        }
+    }
 
-    rect_clear_clipped(&clip_rects);
+    if (hidden) {
+        wm_show_cursor();
+    }
 }
 
 /* Refreshes only a part of the screen.
- * TODO: allow refreshing empty space, filled with black.
  */
 void wm_refresh_partial(rect_t clip) {
-    list_t to_refresh = LIST_HEAD_INIT(to_refresh);
-    list_add(&to_refresh, rect_new_copy(clip));
-
     wm_window_t* win;
+    bool hidden = wm_hide_cursor(clip);
+
     list_for_each_entry(win, &windows) {
         rect_t rect = rect_from_window(win);
 
         if (rect_intersect(rect, clip)) {
             wm_draw_window(win, clip);
-            rect_subtract_clip_rect(&to_refresh, rect);
         }
     }
 
     // Draw black areas where a refresh was needed but no window was present
-    rect_t* r;
-    list_for_each_entry(r, &to_refresh) {
-        uintptr_t off = fb.address + r->top*fb.pitch + r->left*fb.bpp/8;
-        uint32_t size = (r->right - r->left + 1)*fb.bpp/8;
+    for (uint32_t i = 0; i < desktop.count; i++) {
+        if (!rect_intersect(desktop.rects[i], clip)) {
+            continue;
+        }
+
+        rect_t r = rect_clip(desktop.rects[i], clip);
+        uintptr_t off = fb.address + r.top*fb.pitch + r.left*fb.bpp/8;
+        uint32_t size = (r.right - r.left + 1)*fb.bpp/8;
 
-        for (int32_t j = r->top; j <= r->bottom; j++) {
+        for (int32_t j = r.top; j <= r.bottom; j++) {
             memset((void*) off, 0, size);
             off += fb.pitch;
         }
     }
 
-    rect_clear_clipped(&to_refresh);
+    if (hidden) {
+        wm_show_cursor();
+    }
 }
 
 /* Redraws every visible area of the screen.
@@ -379,33 +657,6 @@ void wm_print_windows() {
     printf("none\n");
 }
 
-/* Returns a list of all windows above `win` that overlap with it.
- */
-list_t* wm_get_windows_above(wm_window_t* win) {
-    rect_t win_rect = rect_from_window(win);
-    list_t* list = kmalloc(sizeof(list_t));
-    list_t* iter;
-    wm_window_t* w;
-    bool after = false;
-    *list = LIST_HEAD_INIT(*list);
-
-    list_for_each(iter, w, &windows) {
-        if (after) {
-            rect_t rect = rect_from_window(w);
-
-            if (rect_intersect(win_rect, rect)) {
-                list_add_front(list, w);
-            }
-        }
-
-        if (w == win) {
-            after = true;
-        }
-    }
-
-    return list;
-}
-
 /* Return the window object corresponding to the given id, NULL if none match.
  */
 list_t* wm_get_window(uint32_t id) {
@@ -426,7 +677,7 @@ list_t* wm_get_window(uint32_t id) {
 rect_t wm_mouse_to_rect(mouse_t mouse) {
     return (rect_t) {
         .top = mouse.y, .left = mouse.x,
-        .bottom = mouse.y+MOUSE_SIZE, .right = mouse.x+MOUSE_SIZE
+        .bottom = mouse.y+MOUSE_SIZE-1, .right = mouse.x+MOUSE_SIZE-1
     };
 }
 
@@ -447,21 +698,107 @@ wm_window_t* wm_window_at(int32_t x, int32_t y) {
     return NULL;
 }
 
-void wm_draw_mouse(rect_t new) {
-    uintptr_t addr = fb.address + new.top*fb.pitch + new.left*fb.bpp/8;
+/* Converts the cursor's shape to pixels: 'X' is its outline, '.' its inside,
+ * and 'o' its translucent shadow.
+ */
+void wm_init_cursor() {
+    for (uint32_t y = 0; y < MOUSE_SIZE; y++) {
+        for (uint32_t x = 0; x < MOUSE_SIZE; x++) {
+            uint32_t* pixel = &cursor_image[y*MOUSE_SIZE + x];
+
+            switch (cursor_shape[y][x]) {
+            case 'X':
+                *pixel = 0xFF000000;
+                break;
+            case '.':
+                *pixel = 0xFFFFFFFF;
+                break;
+            case 'o':
+                *pixel = 0x60000000;
+                break;
+            default:
+                *pixel = 0;
+                break;
+            }
+        }
+    }
+}
+
+/* Returns the ARGB pixel `src` drawn over the pixel `dst`.
+ */
+static uint32_t wm_blend(uint32_t src, uint32_t dst) {
+    uint32_t alpha = src >> 24;
+
+    if (alpha == 0xFF) {
+        return src & 0xFFFFFF;
+    } else if (!alpha) {
+        return dst;
+    }
+
+    uint32_t rb = (src & 0xFF00FF)*alpha + (dst & 0xFF00FF)*(0xFF - alpha);
+    uint32_t g = (src & 0xFF00)*alpha + (dst & 0xFF00)*(0xFF - alpha);
+
+    return ((rb >> 8) & 0xFF00FF) | ((g >> 8) & 0xFF00);
+}
 
-    for (int32_t y = 0; y < new.bottom - new.top - 6; y++) {
-        memset((void*) addr, 127, (y + 1) * fb.bpp/8);
-        addr += fb.pitch;
+/* Draws the cursor at the mouse's position, saving the pixels under it.
+ */
+void wm_show_cursor() {
+    if (cursor_shown) {
+        return;
     }
 
-    addr += 4*fb.bpp/8;
+    cursor_rect = wm_mouse_to_rect(mouse);
+    uintptr_t off = fb.address + cursor_rect.top*fb.pitch + cursor_rect.left*fb.bpp/8;
 
-    for (int32_t y = 0; y < 6; y++) {
-        memset((void*) addr, 127, 3 * fb.bpp/8);
-        addr += fb.bpp/8;
-        addr += fb.pitch;
+    for (uint32_t y = 0; y < MOUSE_SIZE; y++) {
+        uint32_t* row = (uint32_t*) off;
+        uint32_t* under = &cursor_under[y*MOUSE_SIZE];
+        uint32_t* image = &cursor_image[y*MOUSE_SIZE];
+
+        for (uint32_t x = 0; x < MOUSE_SIZE; x++) {
+            under[x] = row[x];
+            row[x] = wm_blend(image[x], row[x]);
+        }
+
+        off += fb.pitch;
     }
+
+    cursor_shown = true;
+}
+
+/* Removes the cursor from the screen if it overlaps `clip`, restoring the
+ * pixels it covered. Returns whether it was removed, in which case it must be
+ * shown again once `clip` is drawn.
+ */
+bool wm_hide_cursor(rect_t clip) {
+    if (!cursor_shown || !rect_intersect(clip, cursor_rect)) {
+        return false;
+    }
+
+    uintptr_t off = fb.address + cursor_rect.top*fb.pitch + cursor_rect.left*fb.bpp/8;
+
+    for (uint32_t y = 0; y < MOUSE_SIZE; y++) {
+        memcpy((void*) off, &cursor_under[y*MOUSE_SIZE], MOUSE_SIZE*fb.bpp/8);
+        off += fb.pitch;
+    }
+
+    cursor_shown = false;
+
+    return true;
+}
+
+/* Draws the cursor at the mouse's position if it isn't there already.
+ */
+void wm_move_cursor() {
+    rect_t rect = wm_mouse_to_rect(mouse);
+
+    if (cursor_shown && rect.top == cursor_rect.top && rect.left == cursor_rect.left) {
+        return;
+    }
+
+    wm_hide_cursor(cursor_rect);
+    wm_show_cursor();
 }
 
 /* Handles mouse events. This includes moving the cursor, moving windows along
@@ -472,7 +809,6 @@ void wm_mouse_callback(mouse_t raw_curr) {
     static wm_window_t* dragged = NULL;
     static bool been_dragged = false;
 
-    const mouse_t prev = mouse;
     const float sens = 0.7f;
     const int32_t max_x = fb.width - MOUSE_SIZE - 1;
     const int32_t max_y = fb.height - MOUSE_SIZE - 1;
@@ -508,16 +844,7 @@ void wm_mouse_callback(mouse_t raw_curr) {
                     rect.top + dy < 0 || rect.bottom + dy >= (int32_t) fb.height)) {
                 been_dragged = true;
 
-                dragged->x += dx;
-                dragged->y += dy;
-
-                rect_t new_rect = rect_from_window(dragged);
-
-                wm_refresh_partial(rect);
-                wm_draw_window(dragged, new_rect);
-
-                rect = wm_mouse_to_rect(mouse);
-                wm_draw_mouse(rect);
+                wm_move_window(dragged, dragged->x + dx, dragged->y + dy);
             }
         }
     }
@@ -559,12 +886,8 @@ void wm_mouse_callback(mouse_t raw_curr) {
     }
 
     // Redraw the mouse if needed
-    if (dx || dy || dragged) {
-        rect_t prev_pos = wm_mouse_to_rect(prev);
-        rect_t curr_pos = wm_mouse_to_rect(mouse);
-
-        wm_refresh_partial(prev_pos);
-        wm_draw_mouse(curr_pos);
+    if (dx || dy) {
+        wm_move_cursor();
     }
 
     // Update the saved state
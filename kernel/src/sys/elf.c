@@ -0,0 +1,141 @@
+#include <kernel/elf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/proc.h>
+#include <kernel/sys.h>
+
+#include <string.h>
+
+/* Returns the program header at `index` of the ELF image `data`.
+ */
+const elf_phdr_t* elf_get_phdr(const uint8_t* data, uint32_t index) {
+    const elf_header_t* header = (const elf_header_t*) data;
+
+    return (const elf_phdr_t*) (data + header->phoff + index*header->phentsize);
+}
+
+/* Returns whether `data` is an i386 ELF executable that we can load, with all
+ * of its loadable segments inside the file and in user memory, and at least
+ * one of them.
+ */
+bool elf_is_valid(const uint8_t* data, uint32_t size) {
+    const elf_header_t* header = (const elf_header_t*) data;
+
+    if (size < sizeof(elf_header_t) || header->magic != ELF_MAGIC) {
+        return false;
+    }
+
+    if (header->class != ELF_CLASS_32 || header->data != ELF_DATA_LSB ||
+            header->type != ELF_TYPE_EXEC || header->machine != ELF_MACHINE_386) {
+        return false;
+    }
+
+    if (header->phentsize < sizeof(elf_phdr_t) ||
+            header->phoff + header->phnum*header->phentsize > size) {
+        return false;
+    }
+
+    uint32_t loadable = 0;
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz) {
+            continue;
+        }
+
+        loadable++;
+
+        // Overflows are caught by comparing with both operands
+        if (phdr->offset + phdr->filesz > size ||
+                phdr->offset + phdr->filesz < phdr->offset ||
+                phdr->filesz > phdr->memsz) {
+            return false;
+        }
+
+        if (phdr->vaddr < 0x1000 || phdr->vaddr + phdr->memsz > PROC_STACK_GUARD ||
+                phdr->vaddr + phdr->memsz < phdr->vaddr) {
+            return false;
+        }
+    }
+
+    return loadable > 0;
+}
+
+/* Maps the loadable segments of the valid ELF image `data` in the current
+ * address space, and returns its entry point. Pages are zeroed when mapped, so
+ * that only the initialized part of each segment is copied: `.bss` isn't
+ * stored in the file. Pages of segments that aren't writable are mapped
+ * read-only.
+ * The end of the highest segment is written to `end`.
+ */
+uintptr_t elf_load(const uint8_t* data, uintptr_t* end) {
+    const elf_header_t* header = (const elf_header_t*) data;
+
+    *end = 0;
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz) {
+            continue;
+        }
+
+        uintptr_t first = phdr->vaddr & PAGE_FRAME;
+        uintptr_t last = align_to(phdr->vaddr + phdr->memsz, 0x1000);
+
+        for (uintptr_t page = first; page < last; page += 0x1000) {
+            page_t* p = paging_get_page(page, false, 0);
+
+            // Segments may share a page
+            if (p && *p & PAGE_PRESENT) {
+                continue;
+            }
+
+            paging_map_page(page, pmm_alloc_page(), PAGE_USER | PAGE_RW);
+            memset((void*) page, 0, 0x1000);
+        }
+
+        memcpy((void*) phdr->vaddr, data + phdr->offset, phdr->filesz);
+
+        if (last > *end) {
+            *end = last;
+        }
+    }
+
+    /* Write-protect text and read-only data now that it's been copied. A page
+     * shared with a writable segment stays writable. */
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || phdr->flags & ELF_PF_W) {
+            continue;
+        }
+
+        uintptr_t first = phdr->vaddr & PAGE_FRAME;
+        uintptr_t last = align_to(phdr->vaddr + phdr->memsz, 0x1000);
+
+        for (uintptr_t page = first; page < last; page += 0x1000) {
+            *paging_get_page(page, false, 0) &= ~PAGE_RW;
+            paging_invalidate_page(page);
+        }
+    }
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !(phdr->flags & ELF_PF_W)) {
+            continue;
+        }
+
+        uintptr_t first = phdr->vaddr & PAGE_FRAME;
+        uintptr_t last = align_to(phdr->vaddr + phdr->memsz, 0x1000);
+
+        for (uintptr_t page = first; page < last; page += 0x1000) {
+            *paging_get_page(page, false, 0) |= PAGE_RW;
+            paging_invalidate_page(page);
+        }
+    }
+
+    return header->entry;
+}
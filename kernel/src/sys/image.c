@@ -0,0 +1,229 @@
+#include <kernel/image.h>
+#include <kernel/elf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/sys.h>
+
+#include <list.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Cached images, most recently used first.
+ */
+static list_t images = LIST_HEAD_INIT(images);
+
+/* Drops the cache's references to the pages of `image`, and frees it.
+ */
+static void image_free(image_t* image) {
+    uint32_t num_pages = (image->end - image->start) / 0x1000;
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        if (image->pages[i]) {
+            pmm_free_page(image->pages[i] & PAGE_FRAME);
+        }
+    }
+
+    kfree(image->pages);
+    kfree(image);
+}
+
+/* Frees the least recently used images that no process runs, until there are
+ * at most `IMAGE_CACHE_MAX_IDLE` of them.
+ */
+static void image_trim() {
+    uint32_t idle = 0;
+    list_t* iter;
+    image_t* image;
+
+    list_for_each(iter, image, &images) {
+        if (!image->users) {
+            idle++;
+        }
+    }
+
+    iter = images.prev;
+
+    while (idle > IMAGE_CACHE_MAX_IDLE && iter != &images) {
+        list_t* prev = iter->prev;
+        image = list_entry(iter, image_t);
+
+        if (!image->users) {
+            list_del(iter);
+            image_free(image);
+            idle--;
+        }
+
+        iter = prev;
+    }
+}
+
+/* Returns the cached image of the executable `in` if there is one, counting a
+ * new user for it. Returns NULL otherwise.
+ */
+image_t* image_get(inode_t* in) {
+    list_t* iter;
+    image_t* image;
+
+    list_for_each(iter, image, &images) {
+        if (image->fs_uid == in->fs->uid && image->inode_no == in->inode_no) {
+            list_del(iter);
+            list_add_front(&images, image);
+            image->users++;
+
+            return image;
+        }
+    }
+
+    return NULL;
+}
+
+/* Caches the ELF executable `data` of `size` bytes, read from `in`, and returns
+ * its image with one user. Returns NULL if it isn't a valid ELF executable.
+ */
+image_t* image_create(inode_t* in, const uint8_t* data, uint32_t size) {
+    if (!elf_is_valid(data, size)) {
+        return NULL;
+    }
+
+    const elf_header_t* header = (const elf_header_t*) data;
+    image_t* image = kmalloc(sizeof(image_t));
+
+    *image = (image_t) {
+        .fs_uid = in->fs->uid,
+        .inode_no = in->inode_no,
+        .users = 1,
+        .stale = false,
+        .entry = header->entry,
+        .start = KERNEL_BASE_VIRT,
+        .end = 0
+    };
+
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->memsz) {
+            continue;
+        }
+
+        if ((phdr->vaddr & PAGE_FRAME) < image->start) {
+            image->start = phdr->vaddr & PAGE_FRAME;
+        }
+
+        if (align_to(phdr->vaddr + phdr->memsz, 0x1000) > image->end) {
+            image->end = align_to(phdr->vaddr + phdr->memsz, 0x1000);
+        }
+    }
+
+    uint32_t num_pages = (image->end - image->start) / 0x1000;
+    image->pages = kmalloc(num_pages * sizeof(uint32_t));
+    memset(image->pages, 0, num_pages * sizeof(uint32_t));
+
+    // Copy the file-backed part of each segment into the pages it overlaps
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !phdr->filesz) {
+            continue;
+        }
+
+        uintptr_t seg_end = phdr->vaddr + phdr->filesz;
+
+        for (uintptr_t page = phdr->vaddr & PAGE_FRAME; page < seg_end; page += 0x1000) {
+            uint32_t* entry = &image->pages[(page - image->start) / 0x1000];
+
+            if (!*entry) {
+                *entry = pmm_alloc_page();
+                memset(paging_map_temp(0, *entry), 0, 0x1000);
+            }
+
+            uint8_t* dest = paging_map_temp(0, *entry & PAGE_FRAME);
+            uintptr_t from = page > phdr->vaddr ? page : phdr->vaddr;
+            uintptr_t to = page + 0x1000 < seg_end ? page + 0x1000 : seg_end;
+
+            memcpy(dest + (from - page), data + phdr->offset + (from - phdr->vaddr), to - from);
+        }
+    }
+
+    // Pages of writable segments are copied on the first write to them
+    for (uint32_t i = 0; i < header->phnum; i++) {
+        const elf_phdr_t* phdr = elf_get_phdr(data, i);
+
+        if (phdr->type != ELF_PT_LOAD || !(phdr->flags & ELF_PF_W)) {
+            continue;
+        }
+
+        uintptr_t seg_end = phdr->vaddr + phdr->memsz;
+
+        for (uintptr_t page = phdr->vaddr & PAGE_FRAME; page < seg_end; page += 0x1000) {
+            uint32_t* entry = &image->pages[(page - image->start) / 0x1000];
+
+            if (*entry) {
+                *entry |= PAGE_COW;
+            }
+        }
+    }
+
+    list_add_front(&images, image);
+    image_trim();
+
+    return image;
+}
+
+/* Maps `image` in the current address space. Stored pages are shared with the
+ * cache, read-only or copy-on-write, while the others are zeroed.
+ */
+void image_map(image_t* image) {
+    uint32_t num_pages = (image->end - image->start) / 0x1000;
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        uintptr_t virt = image->start + i*0x1000;
+        uint32_t entry = image->pages[i];
+
+        if (entry) {
+            pmm_ref_page(entry & PAGE_FRAME);
+            paging_map_page(virt, entry & PAGE_FRAME, PAGE_USER | (entry & PAGE_COW));
+        } else {
+            paging_map_page(virt, pmm_alloc_page(), PAGE_USER | PAGE_RW);
+            memset((void*) virt, 0, 0x1000);
+        }
+    }
+}
+
+/* Called when a process stops running `image`. Idle images stay cached until
+ * they're the least recently used ones.
+ */
+void image_release(image_t* image) {
+    image->users--;
+
+    if (image->stale) {
+        if (!image->users) {
+            image_free(image);
+        }
+
+        return;
+    }
+
+    image_trim();
+}
+
+/* Evicts the image of the executable `in`, if cached, as its file changed.
+ * Processes running it keep their own references to its pages.
+ */
+void image_invalidate(inode_t* in) {
+    list_t* iter;
+    image_t* image;
+
+    list_for_each(iter, image, &images) {
+        if (image->fs_uid == in->fs->uid && image->inode_no == in->inode_no) {
+            list_del(iter);
+
+            if (image->users) {
+                image->stale = true;
+            } else {
+                image_free(image);
+            }
+
+            return;
+        }
+    }
+}
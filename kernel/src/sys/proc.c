@@ -3,13 +3,18 @@
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
 #include <kernel/gdt.h>
+#include <kernel/elf.h>
 #include <kernel/fpu.h>
 #include <kernel/fs.h>
+#include <kernel/page_cache.h>
 #include <kernel/pipe.h>
+#include <kernel/wm.h>
 #include <kernel/sys.h>
 
 #include <kernel/sched_robin.h>
+#include <kernel/uapi/uapi_mman.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,71 +30,74 @@ void init_proc() {
     scheduler = sched_robin();
 }
 
-/* Creates a process running the code specified at `code` in raw instructions
- * and add it to the process queue, after the currently executing process.
- * `argv` is the array of arguments, NULL terminated.
+/* Copies the NULL-terminated `argv` to `args` as kernel strings, in reverse
+ * order, so that they survive a change of address space.
  */
-process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
-    static uintptr_t temp_page = 0;
-
-    if (!temp_page) {
-        temp_page = (uintptr_t) kamalloc(0x1000, 0x1000);
-    }
-
-    // Save arguments before switching directory and losing them
-    list_t args = LIST_HEAD_INIT(args);
-
+static void proc_save_args(list_t* args, char** argv) {
     while (argv && *argv) {
-        list_add_front(&args, strdup(*argv));
+        list_add_front(args, strdup(*argv));
         argv++;
     }
+}
 
-    // Allocate one page more than the program size to accomodate static
-    // variables.
-    // TODO: this assumes .bss sections are marked as progbits
-    uint32_t num_code_pages = divide_up(size, 0x1000);
-    uint32_t num_stack_pages = PROC_STACK_PAGES;
-
-    process_t* process = kmalloc(sizeof(process_t));
-    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
-    uintptr_t pd_phys = pmm_alloc_page();
+/* Maps the executable in the current page directory, along with the top of a
+ * stack holding the arguments saved in `args`, which are freed.
+ * The executable is either the cached `image`, or if it's NULL, `code`: an ELF
+ * image or a flat binary loaded at 0x1000.
+ * Sets the memory layout and entry point of `process` and returns its initial
+ * user stack pointer.
+ */
+static uintptr_t proc_load_image(process_t* process, image_t* image,
+        uint8_t* code, uint32_t size, list_t* args) {
+    uint32_t num_code_pages;
+
+    process->image = image;
+
+    if (image) {
+        image_map(image);
+        process->entry = image->entry;
+        num_code_pages = divide_up(image->end - 0x1000, 0x1000);
+    } else if (elf_is_valid(code, size)) {
+        uintptr_t end;
+        process->entry = elf_load(code, &end);
+        num_code_pages = divide_up(end - 0x1000, 0x1000);
+    } else {
+        // Flat binaries have their .bss sections marked as progbits
+        num_code_pages = divide_up(size, 0x1000);
+
+        // Map the code and copy it to physical pages, zero out the excess
+        // memory
+        // TODO: don't require contiguous pages
+        uintptr_t code_phys = pmm_alloc_pages(num_code_pages);
+        paging_map_pages(0x00001000, code_phys, num_code_pages, PAGE_USER | PAGE_RW);
+        memcpy((void*) 0x00001000, (void*) code, size);
+        memset((uint8_t*) 0x1000 + size, 0, num_code_pages * 0x1000 - size);
+        process->entry = 0x00001000;
+    }
 
-    // Copy the kernel page directory with a temporary mapping
-    page_t* p = paging_get_page(temp_page, false, 0);
-    *p = pd_phys | PAGE_PRESENT | PAGE_RW;
-    memcpy((void*) temp_page, (void*) 0xFFFFF000, 0x1000);
-    directory_entry_t* pd = (directory_entry_t*) temp_page;
-    pd[1023] = pd_phys | PAGE_PRESENT | PAGE_RW;
+    // Only the stack pages holding arguments are mapped now, the rest of the
+    // stack is mapped on first touch
+    uint32_t args_size = 16;
+    char* arg;
 
-    // ">> 22" grabs the address's index in the page directory, see `paging.c`
-    for (uint32_t i = 0; i < (KERNEL_BASE_VIRT >> 22); i++) {
-        pd[i] = 0; // Unmap everything below the kernel
+    list_for_each_entry(arg, args) {
+        args_size += strlen(arg) + 8;
     }
 
-    // We can now switch to that directory to modify it easily
-    uintptr_t previous_pd = *paging_get_page(0xFFFFF000, false, 0) & PAGE_FRAME;
-    paging_switch_directory(pd_phys);
-
-    // Map the code and copy it to physical pages, zero out the excess memory
-    // for static variables
-    // TODO: don't require contiguous pages
-    uintptr_t code_phys = pmm_alloc_pages(num_code_pages);
-    paging_map_pages(0x00001000, code_phys, num_code_pages, PAGE_USER | PAGE_RW);
-    memcpy((void*) 0x00001000, (void*) code, size);
-    memset((uint8_t*) 0x1000 + size, 0, num_code_pages * 0x1000 - size);
+    uint32_t num_stack_pages = divide_up(args_size, 0x1000);
 
-    // Map the stack
+    // Map the top of the stack
     uintptr_t stack_phys = pmm_alloc_pages(num_stack_pages);
-    paging_map_pages(0xC0000000 - 0x1000 * num_stack_pages, stack_phys,
+    paging_map_pages(PROC_STACK_TOP - 0x1000 * num_stack_pages, stack_phys,
         num_stack_pages, PAGE_USER | PAGE_RW);
 
     /* Setup the (argc, argv) part of the userstack, start by copying the given
      * arguments on that stack. */
     list_t arglist = LIST_HEAD_INIT(arglist);
-    char* ustack_char = (char*) (0xC0000000 - 1);
+    char* ustack_char = (char*) (PROC_STACK_TOP - 1);
 
-    char* arg;
-    list_for_each_entry(arg, &args) {
+    while (!list_empty(args)) {
+        arg = list_first_entry(args, char);
         uint32_t len = strlen(arg);
 
         // We need (ustack_char - len) to be 4-bytes aligned
@@ -100,6 +108,7 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         ustack_char -= len + 1; // Keep pointing to a free byte
 
         list_add(&arglist, (void*) dest);
+        list_del(list_first(args));
         kfree(arg);
     }
 
@@ -108,8 +117,9 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
     uint32_t* ustack_int = (uint32_t*) ((uintptr_t) ustack_char & ~0x3);
     uint32_t arg_count = 0;
 
-    list_for_each_entry(arg, &arglist) {
-        *(ustack_int--) = (uintptr_t) arg;
+    while (!list_empty(&arglist)) {
+        *(ustack_int--) = (uintptr_t) list_first_entry(&arglist, char);
+        list_del(list_first(&arglist));
         arg_count++;
     }
 
@@ -118,23 +128,57 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
     *(ustack_int--) = arg_count ? argsptr : (uintptr_t) NULL;
     *(ustack_int--) = arg_count;
 
-    // Switch to the original page directory
-    paging_switch_directory(previous_pd);
+    process->code_len = num_code_pages;
+    process->stack_len = num_stack_pages;
+    process->mem_len = 0;
+    process->mmap_bottom = PROC_MMAP_TOP;
+
+    return (uintptr_t) ustack_int;
+}
+
+/* Creates a process running either the cached `image`, or if it's NULL, the
+ * executable `code`, and adds it to the process queue, after the currently
+ * executing process. `argv` is the array of arguments, NULL terminated.
+ */
+static process_t* proc_run_image(image_t* image, uint8_t* code, uint32_t size, char** argv) {
+    // Save arguments before switching directory and losing them
+    list_t args = LIST_HEAD_INIT(args);
+    proc_save_args(&args, argv);
+
+    process_t* process = kmalloc(sizeof(process_t));
+    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
+    uintptr_t pd_phys = pmm_alloc_page();
+
+    // Copy the kernel page directory with a temporary mapping
+    directory_entry_t* pd = paging_map_temp(0, pd_phys);
+    memcpy(pd, (void*) 0xFFFFF000, 0x1000);
+    pd[1023] = pd_phys | PAGE_PRESENT | PAGE_RW;
+
+    // ">> 22" grabs the address's index in the page directory, see `paging.c`
+    for (uint32_t i = 0; i < (KERNEL_BASE_VIRT >> 22); i++) {
+        pd[i] = 0; // Unmap everything below the kernel
+    }
 
     *process = (process_t) {
         .pid = next_pid++,
-        .code_len = num_code_pages,
-        .stack_len = num_stack_pages,
         .directory = pd_phys,
         .kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
         .saved_kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4,
-        .initial_user_stack = (uintptr_t) ustack_int,
-        .mem_len = 0,
         .sleep_ticks = 0,
         .filetable = LIST_HEAD_INIT(process->filetable),
-        .cwd = strdup("/")
+        .cwd = strdup("/"),
+        .minor_faults = 0
     };
 
+    // We can now switch to that directory to modify it easily
+    uintptr_t previous_pd = *paging_get_page(0xFFFFF000, false, 0) & PAGE_FRAME;
+    paging_switch_directory(pd_phys);
+
+    process->initial_user_stack = proc_load_image(process, image, code, size, &args);
+
+    // Switch to the original page directory
+    paging_switch_directory(previous_pd);
+
     // We use this label as the return address from `proc_switch_process`
     uint32_t* jmp = &irq_handler_end;
 
@@ -153,7 +197,8 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         "push %%eax\n"         // %esp
         "push $0x202\n"        // %eflags with `IF` bit set
         "push $0x1B\n"         // user cs selector
-        "push $0x00001000\n"   // %eip
+        "mov %[entry], %%eax\n"
+        "push %%eax\n"         // %eip
         // Push error code, interrupt number
         "sub $8, %%esp\n"
         // `pusha` equivalent
@@ -183,7 +228,8 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
         : [esp] "=r" (process->saved_kernel_stack)
         : [kstack] "r" (process->kernel_stack),
           [ustack] "r" (process->initial_user_stack),
-          [jmp] "r" (jmp)
+          [jmp] "r" (jmp),
+          [entry] "r" (process->entry)
         : "%eax", "%ebx"
     );
 
@@ -192,6 +238,14 @@ process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
     return process;
 }
 
+/* Creates a process running the code specified at `code` in raw instructions
+ * and add it to the process queue, after the currently executing process.
+ * `argv` is the array of arguments, NULL terminated.
+ */
+process_t* proc_run_code(uint8_t* code, uint32_t size, char** argv) {
+    return proc_run_image(NULL, code, size, argv);
+}
+
 /* Runs the scheduler. The scheduler may then decide to elect a new process, or
  * not.
  */
@@ -243,9 +297,11 @@ void proc_enter_usermode() {
         "push %%eax\n"       // %esp
         "push $0x202\n"      // %eflags with IF set
         "push $0x1B\n"       // %cs
-        "push $0x00001000\n" // %eip
+        "mov %[entry], %%eax\n"
+        "push %%eax\n"       // %eip
         "iret\n"
-        :: [ustack] "r" (current_process->initial_user_stack)
+        :: [ustack] "r" (current_process->initial_user_stack),
+           [entry] "r" (current_process->entry)
         : "%eax");
 }
 
@@ -321,13 +377,11 @@ void proc_exit() {
     // Free allocated pages: code, heap, stack, page directory
     directory_entry_t* pd = (directory_entry_t*) 0xFFFFF000;
 
-    for (uint32_t i = 0; i < 768; i++) {
-        if (!(pd[i] & PAGE_PRESENT)) {
-            continue;
-        }
+    paging_free_user_space();
+    wm_release_surfaces();
 
-        uintptr_t page = pd[i] & PAGE_FRAME;
-        pmm_free_page(page);
+    if (current_process->image) {
+        image_release(current_process->image);
     }
 
     uintptr_t pd_page = pd[1023] & PAGE_FRAME;
@@ -355,6 +409,17 @@ uint32_t proc_get_current_pid() {
     }
 }
 
+uint32_t proc_get_minor_faults() {
+    return current_process->minor_faults;
+}
+
+/* Returns the current process's working directory, which it owns: it may be
+ * freed by the next `proc_chdir`.
+ */
+const char* proc_peek_cwd() {
+    return current_process->cwd;
+}
+
 /* Returns a dynamically allocated copy of the current process's current working
  * directory.
  */
@@ -368,43 +433,29 @@ void proc_sleep(uint32_t ms) {
 }
 
 /* Extends the program's writeable memory by `size` bytes.
+ * Pages are only reserved here, they're mapped when first touched.
  * Note: the real granularity is by the page, but the program doesn't need the
  * details.
  */
 void* proc_sbrk(intptr_t size) {
     uintptr_t end = 0x1000 + 0x1000*current_process->code_len + current_process->mem_len;
 
-    // Bytes available in the last allocated page
-    int32_t remaining_bytes = (end % 0x1000) ? (0x1000 - (end % 0x1000)) : 0;
-
     if (size > 0) {
-        // We have to allocate more pages
-        if (remaining_bytes < size) {
-            uint32_t needed_size = size - remaining_bytes;
-            uint32_t num = divide_up(needed_size, 0x1000);
-
-            if (!paging_alloc_pages(align_to(end, 0x1000), num)) {
-                return (void*) -1;
-            }
+        // Keep clear of file mappings, and of the stack and its guard
+        if (end + size < end || end + size > current_process->mmap_bottom) {
+            return (void*) -1;
         }
     } else if (size < 0) {
-        if (end + size < 0x1000*current_process->code_len) {
+        if (end + size < 0x1000 + 0x1000*current_process->code_len) {
             return (void*) -1; // Can't deallocate the code
         }
 
-        int32_t taken = 0x1000 - remaining_bytes;
-
-        // We must free at least a page
-        if (taken + size < 0) {
-            uint32_t freed_size = taken - size; // Account for sign
-            uint32_t num = divide_up(freed_size, 0x1000);
+        // Free the pages now entirely past the break, if they were touched
+        uintptr_t first = align_to(end + size, 0x1000);
 
-            // Align to the beginning of the last mapped page
-            uintptr_t virt = end - (end % 0x1000);
-
-            for (uint32_t i = 0; i < num; i++) {
-                paging_unmap_page(virt - 0x1000*i);
-            }
+        for (uintptr_t virt = first; virt < end; virt += 0x1000) {
+            paging_unmap_page(virt);
+            paging_invalidate_page(virt);
         }
     }
 
@@ -413,50 +464,225 @@ void* proc_sbrk(intptr_t size) {
     return (void*) end;
 }
 
-int32_t proc_exec(const char* path, char** argv) {
-    /* Read the executable */
+/* Maps a zeroed page at `addr` if it's in the heap or the stack of the current
+ * process, but wasn't touched yet. Returns whether a page was mapped.
+ * Called on page faults.
+ */
+bool proc_map_lazy_page(uintptr_t addr) {
+    if (!current_process) {
+        return false;
+    }
+
+    uintptr_t heap_begin = 0x1000 + 0x1000*current_process->code_len;
+    uintptr_t heap_end = heap_begin + current_process->mem_len;
+    bool in_heap = addr >= heap_begin && addr < heap_end;
+    bool in_stack = addr >= PROC_STACK_LIMIT && addr < PROC_STACK_TOP;
+
+    if (!in_heap && !in_stack) {
+        if (addr >= PROC_STACK_GUARD && addr < PROC_STACK_LIMIT) {
+            printke("stack overflow in process %d", current_process->pid);
+        }
+
+        return false;
+    }
+
+    uintptr_t page = addr & PAGE_FRAME;
+
+    paging_map_page(page, pmm_alloc_page(), PAGE_USER | PAGE_RW);
+    memset((void*) page, 0, 0x1000);
+    current_process->minor_faults++;
+
+    if (in_stack) {
+        current_process->stack_len = max(current_process->stack_len,
+            (PROC_STACK_TOP - page) / 0x1000);
+    }
+
+    return true;
+}
+
+/* Gives `process` a copy of the current process's file descriptors.
+ */
+static void proc_clone_fds(process_t* process) {
+    ft_entry_t* ent;
+
+    list_for_each_entry(ent, &current_process->filetable) {
+        ent->refcount++;
+        list_add_front(&process->filetable, ent);
+    }
+}
+
+/* Finds the executable file at `path`. If it's an ELF executable, its cached
+ * image is written to `image`, reading and caching it first if needed.
+ * Otherwise, the file is read into a kmalloc'ed buffer written to `data`,
+ * and its size to `size`.
+ * Returns -1 on failure or if it's a malformed ELF file, zero otherwise.
+ */
+static int32_t proc_find_executable(const char* path, image_t** image,
+        uint8_t** data, uint32_t* size) {
     inode_t* in = fs_open(path, O_RDONLY);
 
     if (!in || in->type != DENT_FILE) {
         return -1;
     }
 
-    uint8_t* data = kmalloc(in->size);
-    uint32_t read = fs_read(in, 0, data, in->size);
+    *image = image_get(in);
+    *data = NULL;
 
-    if (read == in->size && in->size) {
-        process_t* p = proc_run_code(data, in->size, argv);
+    if (*image) {
+        return 0;
+    }
 
-        // Clone file descriptors
-        if (proc_get_current_pid()) {
-            ft_entry_t* ent;
+    uint8_t* buf = kmalloc(in->size);
+    uint32_t read = fs_read(in, 0, buf, in->size);
 
-            list_for_each_entry(ent, &current_process->filetable) {
-                ent->refcount++;
-                list_add_front(&p->filetable, ent);
-            }
-        }
-    } else {
+    if (read != in->size || !in->size) {
         printke("exec failed while reading the executable");
+        kfree(buf);
         return -1;
     }
 
+    // Anything else is loaded as a flat binary
+    if (*(uint32_t*) buf == ELF_MAGIC) {
+        *image = image_create(in, buf, in->size);
+        kfree(buf);
+
+        if (!*image) {
+            printke("exec failed: invalid ELF executable");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    *data = buf;
+    *size = in->size;
+
+    return 0;
+}
+
+int32_t proc_exec(const char* path, char** argv) {
+    image_t* image;
+    uint8_t* data;
+    uint32_t size;
+
+    if (proc_find_executable(path, &image, &data, &size) < 0) {
+        return -1;
+    }
+
+    process_t* p = proc_run_image(image, data, size, argv);
+    kfree(data);
+
+    // Clone file descriptors
+    if (proc_get_current_pid()) {
+        proc_clone_fds(p);
+    }
+
+    return 0;
+}
+
+/* Duplicates the current process, which is in the middle of the system call
+ * described by `regs`. User pages are shared between both processes, and only
+ * copied when one of them writes to them.
+ * Returns the pid of the child, which sees a return value of zero.
+ */
+uint32_t proc_fork(registers_t* regs) {
+    process_t* child = kmalloc(sizeof(process_t));
+    uintptr_t kernel_stack = (uintptr_t) aligned_alloc(4, 0x1000 * PROC_KERNEL_STACK_PAGES);
+
+    *child = *current_process;
+    child->pid = next_pid++;
+    child->directory = paging_fork_directory();
+    child->kernel_stack = kernel_stack + PROC_KERNEL_STACK_PAGES * 0x1000 - 4;
+    child->sleep_ticks = 0;
+    child->filetable = LIST_HEAD_INIT(child->filetable);
+    child->cwd = strdup(current_process->cwd);
+    child->minor_faults = 0;
+
+    if (child->image) {
+        child->image->users++;
+    }
+
+    fpu_save_state(child);
+    proc_clone_fds(child);
+
+    /* Setup the child's kernel stack so that it returns from this system call
+     * like its parent, through `irq_handler_end`, see `proc_run_code`. */
+    registers_t* child_regs = (registers_t*) (child->kernel_stack - sizeof(registers_t));
+    *child_regs = *regs;
+    child_regs->eax = 0;
+
+    uint32_t* kstack = (uint32_t*) child_regs;
+    *(--kstack) = (uintptr_t) &irq_handler_end;
+    *(--kstack) = 0; // %ebx, %esi, %edi, %ebp
+    *(--kstack) = 0;
+    *(--kstack) = 0;
+    *(--kstack) = 0;
+    child->saved_kernel_stack = (uintptr_t) kstack;
+
+    scheduler->sched_add(scheduler, child);
+
+    return child->pid;
+}
+
+/* Replaces the image of the current process by the executable at `path`,
+ * keeping its pid, file descriptors and working directory. `regs` describes
+ * the system call, and is modified to return to the start of the new image.
+ * Returns -1 on failure, in which case the process is left untouched.
+ */
+int32_t proc_execve(const char* path, char** argv, registers_t* regs) {
+    image_t* image;
+    uint8_t* data;
+    uint32_t size;
+
+    if (proc_find_executable(path, &image, &data, &size) < 0) {
+        return -1;
+    }
+
+    // Arguments live in the address space we're about to free
+    list_t args = LIST_HEAD_INIT(args);
+    proc_save_args(&args, argv);
+
+    paging_free_user_space();
+    wm_release_surfaces();
+
+    if (current_process->image) {
+        image_release(current_process->image);
+    }
+
+    current_process->initial_user_stack = proc_load_image(current_process,
+        image, data, size, &args);
+    kfree(data);
+
+    *regs = (registers_t) {
+        .gs = regs->gs, .fs = regs->fs, .es = regs->es, .ds = regs->ds,
+        .eip = current_process->entry,
+        .cs = regs->cs,
+        .eflags = 0x202,
+        .esp = current_process->initial_user_stack,
+        .ss = regs->ss
+    };
+
     return 0;
 }
 
 uint32_t proc_open(const char* path, uint32_t flags) {
     inode_t* in = fs_open((char*) path, flags); // TODO
 
+    if (in && flags & O_TRUNC && in->type == DENT_FILE) {
+        fs_truncate(in, 0);
+    }
+
     if (in) {
         ft_entry_t* ent = kmalloc(sizeof(ft_entry_t));
 
         ent->fd = proc_next_fd();
         ent->inode = in;
-        ent->mode = 0; // TODO: make use of this or delete it?
+        ent->mode = flags;
         ent->offset = 0;
         ent->size = in->size;
-        ent->index = 0;
+        ent->cursor = (dir_cursor_t) { .node = NULL, .index = 0, .version = 0 };
         ent->refcount = 1;
+        ent->readahead = (readahead_t) { .next = 0, .window = 0, .ahead = 0 };
 
         list_add_front(&current_process->filetable, ent);
 
@@ -483,7 +709,7 @@ uint32_t proc_read(uint32_t fd, uint8_t* buf, uint32_t size) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
 
     if (ent) {
-        uint32_t read = fs_read(ent->inode, ent->offset, buf, size);
+        uint32_t read = page_cache_read(ent->inode, ent->offset, buf, size, &ent->readahead);
         ent->offset += read;
         return read;
     }
@@ -495,26 +721,60 @@ int32_t proc_readdir(uint32_t fd, sos_directory_entry_t* dent) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
 
     if (ent) {
-        uint32_t read = fs_readdir(ent->inode, ent->index, dent, dent->entry_size);
+        uint32_t read = fs_readdir(ent->inode, &ent->cursor, dent, dent->entry_size);
         ent->offset += read;
 
-        if (read) {
-            ent->index++;
-            return 1;
+        return read ? 1 : 0;
+    }
+
+    return -1;
+}
+
+/* Fills `buf` with as many of the next entries of the directory `fd` as fit in
+ * `size` bytes, packed one after the other; see `entry_size`.
+ * Returns the number of bytes written, zero at the end of the directory, or -1
+ * on error, including when the next entry doesn't fit.
+ */
+int32_t proc_getdents(uint32_t fd, uint8_t* buf, uint32_t size) {
+    ft_entry_t* ent = proc_fd_to_entry(fd);
+
+    if (!ent || ent->inode->type != DENT_DIRECTORY) {
+        return -1;
+    }
+
+    uint32_t total = 0;
+
+    while (true) {
+        sos_directory_entry_t* dent = (sos_directory_entry_t*) (buf + total);
+        uint32_t read = fs_readdir(ent->inode, &ent->cursor, dent, size - total);
+
+        if (!read) {
+            break;
         }
 
-        return 0;
+        total += read;
     }
 
-    return -1;
+    // Tell apart a full buffer from the end of the directory
+    if (!total && ent->cursor.node != &((folder_inode_t*) ent->inode)->subfiles) {
+        return -1;
+    }
+
+    ent->offset += total;
+
+    return total;
 }
 
 uint32_t proc_write(uint32_t fd, uint8_t* buf, uint32_t size) {
     ft_entry_t* ent = proc_fd_to_entry(fd);
 
     if (ent) {
-        uint32_t written = fs_write(ent->inode, buf, size);
-        ent->offset += written;
+        uint32_t offset = ent->mode & O_APPEND ? ent->inode->size : ent->offset;
+        uint32_t written = fs_write(ent->inode, offset, buf, size);
+
+        ent->offset = offset + written;
+        ent->size = ent->inode->size;
+
         return written;
     }
 
@@ -556,17 +816,135 @@ int32_t proc_ftell(uint32_t fd) {
 }
 
 int32_t proc_chdir(const char* path) {
-    // TODO: replace existence check with `stat` to validate path
-    char* npath = fs_normalize_path(path);
+    char npath[MAX_PATH];
+
+    if (!fs_normalize_path(path, npath)) {
+        return -1;
+    }
+
     inode_t* in = fs_open(npath, O_RDONLY);
 
-    if (in) {
-        kfree(npath);
+    if (!in || in->type != DENT_DIRECTORY) {
         return -1;
     }
 
     kfree(current_process->cwd);
-    current_process->cwd = npath;
+    current_process->cwd = strdup(npath);
+
+    return 0;
+}
+
+/* Reserves `num_pages` pages of address space right below the lowest file
+ * mapping. Returns their address, or zero if they'd run into the heap.
+ */
+static uintptr_t proc_mmap_reserve(uint32_t num_pages) {
+    uintptr_t heap_end = 0x1000 + 0x1000*current_process->code_len + current_process->mem_len;
+
+    if (!num_pages || num_pages > (current_process->mmap_bottom - heap_end) / 0x1000) {
+        return 0;
+    }
+
+    current_process->mmap_bottom -= num_pages*0x1000;
+
+    return current_process->mmap_bottom;
+}
+
+/* Maps `length` bytes of the file open as `fd`, from `offset`, right below the
+ * lowest file mapping. The pages are those of the page cache: shared mappings
+ * are read-only and see writes to the file, while writable private mappings
+ * get their own copy of a page on the first write to it. Pages past the end of
+ * the file are zeroed.
+ * Returns the address of the mapping, or `MAP_FAILED`.
+ */
+void* proc_mmap(uint32_t fd, uint32_t offset, uint32_t length, uint32_t prot, uint32_t flags) {
+    ft_entry_t* ent = proc_fd_to_entry(fd);
+    uint32_t num_pages = divide_up(length, 0x1000);
+
+    if (!ent || ent->inode->type != DENT_FILE || !length || offset % 0x1000) {
+        return MAP_FAILED;
+    }
+
+    // Writes to shared mappings would need to be written back to the file
+    if ((flags != MAP_SHARED && flags != MAP_PRIVATE)
+            || (flags == MAP_SHARED && prot & PROT_WRITE)) {
+        return MAP_FAILED;
+    }
+
+    uintptr_t start = proc_mmap_reserve(num_pages);
+    bool writable = prot & PROT_WRITE;
+
+    if (!start) {
+        return MAP_FAILED;
+    }
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        uintptr_t virt = start + i*0x1000;
+        uintptr_t frame = page_cache_get_frame(ent->inode, offset/0x1000 + i);
+
+        if (frame) {
+            paging_map_page(virt, frame, PAGE_USER | (writable ? PAGE_COW : 0));
+            continue;
+        }
+
+        // Either the page is past the end of the file, or we're out of memory
+        if (offset + i*0x1000 < ent->inode->size || !(frame = pmm_alloc_page())) {
+            proc_munmap(start, i*0x1000);
+            return MAP_FAILED;
+        }
+
+        memset(paging_map_temp(0, frame), 0, 0x1000);
+        paging_map_page(virt, frame, PAGE_USER | (writable ? PAGE_RW : 0));
+    }
+
+    return (void*) start;
+}
+
+/* Maps the `size` bytes of page-aligned kernel memory at `addr` in the current
+ * process, below its file mappings. Both sides then share the same pages,
+ * including across forks.
+ * Returns the address of the mapping, or NULL if there's no room for it.
+ */
+void* proc_map_shared(uintptr_t addr, uint32_t size) {
+    uint32_t num_pages = divide_up(size, 0x1000);
+    uintptr_t start = proc_mmap_reserve(num_pages);
+
+    if (!start) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num_pages; i++) {
+        uintptr_t phys = paging_virt_to_phys(addr + i*0x1000);
+
+        pmm_ref_page(phys);
+        paging_map_page(start + i*0x1000, phys, PAGE_USER | PAGE_RW | PAGE_SHARED);
+    }
+
+    return (void*) start;
+}
+
+/* Unmaps the pages of file mappings between `addr` and `addr + length`. Their
+ * addresses can be reused once the mappings below them are gone.
+ * Returns -1 if the range isn't made of file mappings, zero otherwise.
+ */
+int32_t proc_munmap(uintptr_t addr, uint32_t length) {
+    uint32_t num_pages = divide_up(length, 0x1000);
+
+    if (addr % 0x1000 || addr < current_process->mmap_bottom
+            || num_pages > (PROC_MMAP_TOP - addr) / 0x1000) {
+        return -1;
+    }
+
+    paging_unmap_pages(addr, num_pages);
+
+    while (current_process->mmap_bottom < PROC_MMAP_TOP) {
+        page_t* page = paging_get_page(current_process->mmap_bottom, false, 0);
+
+        if (page && *page & PAGE_PRESENT) {
+            break;
+        }
+
+        current_process->mmap_bottom += 0x1000;
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <kernel/syscall.h>
 #include <kernel/pmm.h>
 #include <kernel/fs.h>
+#include <kernel/page_cache.h>
 #include <kernel/proc.h>
 #include <kernel/timer.h>
 #include <kernel/fb.h>
@@ -13,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <kernel/uapi/uapi_mman.h>
 #include <kernel/uapi/uapi_syscall.h>
 
 static void syscall_handler(registers_t* regs);
@@ -39,6 +41,12 @@ static void syscall_unlink(registers_t* regs);
 static void syscall_rename(registers_t* regs);
 static void syscall_maketty(registers_t* regs);
 static void syscall_stat(registers_t* regs);
+static void syscall_fork(registers_t* regs);
+static void syscall_execve(registers_t* regs);
+static void syscall_getdents(registers_t* regs);
+static void syscall_sync(registers_t* regs);
+static void syscall_mmap(registers_t* regs);
+static void syscall_munmap(registers_t* regs);
 
 handler_t syscall_handlers[SYSCALL_NUM] = { 0 };
 
@@ -67,6 +75,12 @@ void init_syscall() {
     syscall_handlers[SYS_RENAME] = syscall_rename;
     syscall_handlers[SYS_MAKETTY] = syscall_maketty;
     syscall_handlers[SYS_STAT] = syscall_stat;
+    syscall_handlers[SYS_FORK] = syscall_fork;
+    syscall_handlers[SYS_EXECVE] = syscall_execve;
+    syscall_handlers[SYS_GETDENTS] = syscall_getdents;
+    syscall_handlers[SYS_SYNC] = syscall_sync;
+    syscall_handlers[SYS_MMAP] = syscall_mmap;
+    syscall_handlers[SYS_MUNMAP] = syscall_munmap;
 }
 
 static void syscall_handler(registers_t* regs) {
@@ -165,6 +179,15 @@ static void syscall_info(registers_t* regs) {
     if (request & SYS_INFO_LOG && info->kernel_log) {
         strcpy(info->kernel_log, serial_get_log());
     }
+
+    if (request & SYS_INFO_PROC) {
+        info->minor_faults = proc_get_minor_faults();
+    }
+
+    if (request & SYS_INFO_CACHE) {
+        info->page_cache_hits = page_cache_hits();
+        info->page_cache_misses = page_cache_misses();
+    }
 }
 
 static void syscall_exec(registers_t* regs) {
@@ -281,4 +304,45 @@ static void syscall_stat(registers_t* regs) {
     stat_t* buf = (stat_t*) regs->ecx;
 
     regs->eax = fs_stat(path, buf);
-}
\ No newline at end of file
+}
+
+static void syscall_fork(registers_t* regs) {
+    regs->eax = proc_fork(regs);
+}
+
+static void syscall_execve(registers_t* regs) {
+    char* path = (char*) regs->ebx;
+    char** args = (char**) regs->ecx;
+
+    if (proc_execve(path, args, regs) < 0) {
+        regs->eax = -1;
+    }
+}
+
+static void syscall_getdents(registers_t* regs) {
+    uint32_t fd = regs->ebx;
+    uint8_t* buf = (uint8_t*) regs->ecx;
+    uint32_t size = regs->edx;
+
+    regs->eax = proc_getdents(fd, buf, size);
+}
+
+static void syscall_sync(registers_t* regs) {
+    UNUSED(regs);
+
+    fs_sync();
+}
+
+static void syscall_mmap(registers_t* regs) {
+    sys_mmap_t* args = (sys_mmap_t*) regs->ebx;
+
+    regs->eax = (uintptr_t) proc_mmap(args->fd, args->offset, args->length,
+        args->prot, args->flags);
+}
+
+static void syscall_munmap(registers_t* regs) {
+    uintptr_t addr = regs->ebx;
+    uint32_t length = regs->ecx;
+
+    regs->eax = proc_munmap(addr, length);
+}
@@ -7,11 +7,7 @@
 
 typedef uint32_t ino_t;
 
-typedef struct {
-    int32_t fd;
-    char name[MAX_PATH];
-    FILE* stream;
-} DIR;
+#define DIR_BUF_SIZE 1024
 
 struct dirent {
     ino_t d_ino;
@@ -19,6 +15,18 @@ struct dirent {
     uint32_t d_type;
 };
 
+/* Entries are fetched from the kernel in batches, see `SYS_GETDENTS`.
+ */
+typedef struct {
+    int32_t fd;
+    char name[MAX_PATH];
+    FILE* stream;
+    uint8_t buf[DIR_BUF_SIZE];
+    uint32_t buf_len;
+    uint32_t buf_pos;
+    struct dirent dent;
+} DIR;
+
 #ifndef _KERNEL_
 DIR* opendir(const char* path);
 struct dirent* readdir(DIR* dir);
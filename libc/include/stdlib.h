@@ -4,8 +4,7 @@
 #include <stddef.h>
 
 /* `malloc`-related functions.
- * Those implement an allocator used in both the kernel and in userspace, with
- * few implementation changes between the two.
+ * The kernel and userspace have different allocators behind them.
  * In userspace, they have the usual names, and in the kernel, `free` and
  * `malloc` are renamed to `kfree` and `kmalloc` for clarity.
  */
@@ -16,8 +15,20 @@ void* aligned_alloc(size_t alignment, size_t size);
 void* kamalloc(size_t size, size_t align);
 uint32_t memory_usage();
 
+/* Object caches, for kernel structures allocated and freed often.
+ * Small `kmalloc`s are served from such caches too, one per size class, so
+ * that objects from any cache may also be given back with `kfree`.
+ */
+typedef struct kmem_cache_t kmem_cache_t;
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
 #define malloc kmalloc
 #define free kfree
+#else
+void malloc_stats();
 #endif
 
 void* malloc(size_t size);
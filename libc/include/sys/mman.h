@@ -0,0 +1,11 @@
+#pragma once
+
+#include <kernel/uapi/uapi_mman.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _KERNEL_
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, uint32_t offset);
+int munmap(void* addr, size_t length);
+#endif
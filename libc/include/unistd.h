@@ -11,5 +11,8 @@
 int chdir(const char* path);
 char* getcwd(char* buf, size_t size);
 int unlink(const char* path);
+int fork();
+int execv(const char* path, char* const argv[]);
+void sync();
 
 #endif
\ No newline at end of file
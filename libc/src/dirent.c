@@ -9,7 +9,7 @@
 #include <stdio.h>
 
 extern int32_t syscall1(uint32_t eax, uint32_t ebx);
-extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
+extern int32_t syscall3(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx);
 
 /* Opens the directory pointed to by `path` and returns a directory handle.
  * This handle can later be freed by calling `closedir`.
@@ -33,34 +33,37 @@ DIR* opendir(const char* path) {
 
     strcpy(dir->name, path);
     dir->fd = dir->stream->fd;
+    dir->buf_len = 0;
+    dir->buf_pos = 0;
 
     return dir;
 }
 
 /* Returns the next entry in the given directory stream.
+ * The entry belongs to the stream: it's overwritten by the next call to
+ * `readdir` and freed by `closedir`.
  * Returns NULL when no more entries are present.
  */
 struct dirent* readdir(DIR* dir) {
-    uint32_t ent_size = sizeof(sos_directory_entry_t) + MAX_PATH;
-    sos_directory_entry_t* dir_entry = malloc(ent_size);
-    dir_entry->entry_size = ent_size;
+    if (dir->buf_pos >= dir->buf_len) {
+        int32_t read = syscall3(SYS_GETDENTS, dir->fd, (uintptr_t) dir->buf, DIR_BUF_SIZE);
 
-    uint32_t read = syscall2(SYS_READDIR, dir->fd, (uintptr_t) dir_entry);
+        if (read <= 0) {
+            return NULL;
+        }
 
-    if (!read) {
-        free(dir_entry);
-
-        return NULL;
+        dir->buf_len = read;
+        dir->buf_pos = 0;
     }
 
-    struct dirent* d_ent = zalloc(sizeof(struct dirent));
-    d_ent->d_ino = dir_entry->inode;
-    strcpy(d_ent->d_name, dir_entry->name);
-    d_ent->d_type = dir_entry->type;
+    sos_directory_entry_t* dir_entry = (sos_directory_entry_t*) &dir->buf[dir->buf_pos];
+    dir->buf_pos += dir_entry->entry_size;
 
-    free(dir_entry);
+    dir->dent.d_ino = dir_entry->inode;
+    strcpy(dir->dent.d_name, dir_entry->name);
+    dir->dent.d_type = dir_entry->type;
 
-    return d_ent;
+    return &dir->dent;
 }
 
 /* Closes a directory stream previously returned by `opendir`.
@@ -71,7 +74,6 @@ int closedir(DIR* dir) {
     }
 
     fclose(dir->stream);
-    free(dir->name);
     free(dir);
 
     return 0;
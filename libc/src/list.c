@@ -3,11 +3,23 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#ifdef _KERNEL_
+static kmem_cache_t* list_cache = NULL;
+#endif
+
 /* Allocates a node on the heap containing the given data.
  * Note: the node is uninitialized apart from its data.
  */
 list_t* list_node_new(void* data) {
+#ifdef _KERNEL_
+    if (!list_cache) {
+        list_cache = kmem_cache_create("list_t", sizeof(list_t), 0);
+    }
+
+    list_t* node = (list_t*) kmem_cache_alloc(list_cache);
+#else
     list_t* node = (list_t*) malloc(sizeof(list_t));
+#endif
 
     if (!node) {
         return NULL;
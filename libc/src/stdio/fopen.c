@@ -11,7 +11,7 @@ extern int32_t syscall1(uint32_t eax, uint32_t ebx);
 /* Returns a file handle to the file or directory pointed to by `path`.
  * Returns NULL on error.
  * The file handle must be freed using `fclose`.
- * Note: only the "r" mode is supported as a of now.
+ * Note: only the "r", "w" and "a" modes are supported as of now.
  */
 FILE* fopen(const char* path, const char* mode) {
     uint32_t m = 0; // TODO use param
@@ -19,6 +19,8 @@ FILE* fopen(const char* path, const char* mode) {
     if (strchr(mode, 'r')) {
         m = O_RDONLY;
     } else if (strchr(mode, 'w')) {
+        m = O_WRONLY | O_CREAT | O_TRUNC;
+    } else if (strchr(mode, 'a')) {
         m = O_WRONLY | O_CREAT | O_APPEND;
     }
 
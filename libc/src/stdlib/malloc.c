@@ -1,13 +1,17 @@
+#ifdef _KERNEL_
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
 
-#ifdef _KERNEL_
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
 #include <kernel/sys.h>
-#endif
+
+/* Kernel heap allocator: a list of blocks spanning the kernel heap, with small
+ * objects handed to the slab allocator. Userspace has its own, in umalloc.c.
+ */
 
 #define MIN_ALIGN 4
 
@@ -21,40 +25,18 @@ static mem_block_t* bottom = NULL;
 static mem_block_t* top = NULL;
 static uint32_t used_memory = 0;
 
-#ifndef _KERNEL_
+#define HEAP_END (KERNEL_HEAP_BEGIN + KERNEL_HEAP_SIZE)
 
-/* Returns the next multiple of `s` greater than `a`, or `a` if it is a
- * multiple of `s`.
- * Copy of the same function in <kernel/sys.h>
+/* Slabs are taken from the end of the heap, going down, while the block list
+ * grows up from its beginning.
  */
-static uint32_t align_to(uint32_t n, uint32_t align) {
-    if (n % align == 0) {
-        return n;
-    }
+static uintptr_t slab_bottom = HEAP_END;
+static uintptr_t* free_slab_pages = NULL;
 
-    return n + (align - n % align);
-}
-
-/* Allocates `n` pages of memory located after the program's memory.
- * Returns a pointer to the first allocated page.
- */
-static void* sbrk(uint32_t size) {
-    uintptr_t addr;
-
-    asm volatile (
-        "mov $4, %%eax\n"
-        "mov %[size], %%ebx\n"
-        "int $0x30\n"
-        "mov %%eax, %[addr]\n"
-        : [addr] "=r" (addr)
-        : [size] "r" (size)
-        : "%eax", "%ebx"
-    );
-
-    return (void*) addr;
-}
-
-#endif
+// Provided by slab.c
+void* slab_alloc(size_t size, size_t align);
+void slab_free(void* obj);
+size_t slab_size(void* obj);
 
 /* Debugging function to print the block list. Only sizes are listed, and a '#'
  * indicates a used block.
@@ -90,6 +72,82 @@ mem_block_t* mem_get_block(void* pointer) {
     return (mem_block_t*) (addr - sizeof(mem_block_t) + 4);
 }
 
+/* Sets up the block list: it starts with an empty, used block, in order to
+ * avoid edge cases.
+ * The heap is mapped with 4 MiB pages where possible, to spare TLB entries.
+ */
+void mem_init_blocks() {
+    uintptr_t addr = KERNEL_HEAP_BEGIN;
+    uintptr_t end = KERNEL_HEAP_BEGIN + KERNEL_HEAP_SIZE;
+
+    while (addr < end) {
+        uintptr_t phys = 0;
+
+        if (end - addr >= LARGE_PAGE_SIZE) {
+            phys = pmm_alloc_aligned_large_page();
+        }
+
+        if (phys) {
+            paging_map_large_page(addr, phys, PAGE_RW);
+            addr += LARGE_PAGE_SIZE;
+        } else {
+            paging_map_page(addr, pmm_alloc_page(), PAGE_RW);
+            addr += 0x1000;
+        }
+    }
+
+    addr = KERNEL_HEAP_BEGIN;
+    bottom = (mem_block_t*) addr;
+    top = bottom;
+    top->size = 1; // That means used, of size 0
+    top->next = NULL;
+}
+
+/* Returns the number of bytes usable at `pointer`, given that `pointer` was
+ * previously returned by a call to `malloc`.
+ */
+uint32_t mem_usable_size(void* pointer) {
+    if ((uintptr_t) pointer >= slab_bottom) {
+        return slab_size(pointer);
+    }
+
+    return mem_get_block(pointer)->size & ~1;
+}
+
+/* Returns a page of the kernel heap for the slab allocator.
+ */
+void* mem_alloc_slab_page() {
+    if (!top) {
+        mem_init_blocks();
+    }
+
+    used_memory += 0x1000;
+
+    if (free_slab_pages) {
+        uintptr_t* page = free_slab_pages;
+        free_slab_pages = (uintptr_t*) *page;
+
+        return page;
+    }
+
+    if (slab_bottom - 0x1000 < (uintptr_t) top + mem_block_size(top)) {
+        printke("kernel ran out of memory!");
+        abort();
+    }
+
+    slab_bottom -= 0x1000;
+
+    return (void*) slab_bottom;
+}
+
+/* Gives back a page previously returned by `mem_alloc_slab_page`.
+ */
+void mem_free_slab_page(void* page) {
+    *(uintptr_t*) page = (uintptr_t) free_slab_pages;
+    free_slab_pages = page;
+    used_memory -= 0x1000;
+}
+
 /* Appends a new block of the desired size and alignment to the block list.
  * Note: may insert an intermediary block before the one returned to prevent
  * memory fragmentation. Such a block would be aligned to `MIN_ALIGN`.
@@ -152,7 +210,7 @@ mem_block_t* mem_find_block(uint32_t size, uint32_t align) {
 }
 
 /* Returns a pointer to a memory area of at least `size` bytes.
- * Note: in the kernel, this function is renamed to `kmalloc`.
+ * Note: this function is renamed to `kmalloc`.
  */
 void* malloc(size_t size) {
     // Accessing basic datatypes at unaligned addresses is apparently undefined
@@ -180,21 +238,37 @@ void* realloc(void* ptr, size_t size) {
         return NULL;
     }
 
+    uint32_t old_size = mem_usable_size(ptr);
+
+    if (size <= old_size) {
+        return ptr;
+    }
+
     void* new = malloc(size);
-    memcpy(new, ptr, mem_get_block(ptr)->size & ~1);
+
+    if (!new) {
+        return NULL;
+    }
+
+    memcpy(new, ptr, old_size);
     free(ptr);
 
     return new;
 }
 
 /* Frees a pointer previously returned by `malloc`.
- * Note: in the kernel, this function is renamed to `kfree`.
+ * Note: this function is renamed to `kfree`.
  */
 void free(void* pointer) {
     if (!pointer) {
         return;
     }
 
+    if ((uintptr_t) pointer >= slab_bottom) {
+        slab_free(pointer);
+        return;
+    }
+
     mem_block_t* block = mem_get_block(pointer);
     block->size &= ~1;
     used_memory -= block->size;
@@ -204,22 +278,18 @@ void free(void* pointer) {
  */
 void* aligned_alloc(size_t align, size_t size) {
     const uint32_t header_size = offsetof(mem_block_t, data);
+
+    // Small objects are served by the slab allocator
+    void* obj = slab_alloc(size, align);
+
+    if (obj) {
+        return obj;
+    }
+
     size = align_to(size, 8);
 
-    // If this is the first allocation, setup the block list:
-    // it starts with an empty, used block, in order to avoid edge cases.
     if (!top) {
-#ifdef _KERNEL_
-        uintptr_t addr = KERNEL_HEAP_BEGIN;
-        uintptr_t heap_phys = pmm_alloc_pages(KERNEL_HEAP_SIZE/0x1000);
-        paging_map_pages(addr, heap_phys, KERNEL_HEAP_SIZE/0x1000, PAGE_RW);
-#else
-        uintptr_t addr = (uintptr_t) sbrk(header_size);
-#endif
-        bottom = (mem_block_t*) addr;
-        top = bottom;
-        top->size = 1; // That means used, of size 0
-        top->next = NULL;
+        mem_init_blocks();
     }
 
     mem_block_t* block = mem_find_block(size, align);
@@ -234,23 +304,11 @@ void* aligned_alloc(size_t align, size_t size) {
         // exceeded the memory we can distribute.
         uintptr_t end = (uintptr_t) top + mem_block_size(top) + header_size;
         end = align_to(end, align) + size;
-#ifdef _KERNEL_
-        // The kernel can't allocate more
-        if (end > KERNEL_HEAP_BEGIN + KERNEL_HEAP_SIZE) {
+
+        if (end > slab_bottom) {
             printke("kernel ran out of memory!");
             abort();
         }
-#else
-        // But userspace can ask the kernel for more
-        uintptr_t brk = (uintptr_t) sbrk(0);
-        if (end > brk) {
-            if (sbrk(end - brk) == (void*) -1) {
-                printf("[mem] Allocation failure\n");
-
-                return NULL;
-            }
-        }
-#endif
 
         block = mem_new_block(size, align);
     }
@@ -260,7 +318,6 @@ void* aligned_alloc(size_t align, size_t size) {
     return block->data;
 }
 
-#ifdef _KERNEL_
 /* Alias for `aligned_alloc`.
  * It's a naming habit, don't mind it.
  */
@@ -273,4 +330,4 @@ void* kamalloc(uint32_t size, uint32_t align) {
 uint32_t memory_usage() {
     return used_memory;
 }
-#endif
\ No newline at end of file
+#endif
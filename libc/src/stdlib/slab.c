@@ -0,0 +1,222 @@
+#ifdef _KERNEL_
+
+#include <kernel/sys.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* A slab is a page of the kernel heap holding objects of a single size, after
+ * a `slab_t` header. Objects are found back from their slab by rounding their
+ * address down to the page, which makes both allocation and freeing O(1).
+ */
+#define SLAB_SIZE 0x1000
+
+/* Size classes used for small `kmalloc`s, from 8 to 512 bytes.
+ */
+#define SLAB_MIN_SHIFT 3
+#define SLAB_MAX_SHIFT 9
+#define SLAB_NUM_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+typedef struct slab_t {
+    kmem_cache_t* cache;
+    struct slab_t* next;
+    struct slab_t* prev;
+    void* free; // Singly linked list of free objects
+    uint32_t used;
+} slab_t;
+
+struct kmem_cache_t {
+    const char* name;
+    uint32_t size;
+    uint32_t offset; // Of the first object in a slab
+    uint32_t per_slab;
+    slab_t* partial; // Slabs with at least a free object
+    slab_t* full;
+};
+
+// Provided by malloc.c
+void* mem_alloc_slab_page();
+void mem_free_slab_page(void* page);
+
+static kmem_cache_t size_caches[SLAB_NUM_CLASSES];
+static const char* size_cache_names[SLAB_NUM_CLASSES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64",
+    "kmalloc-128", "kmalloc-256", "kmalloc-512"
+};
+
+/* Sets up a cache of objects of `size` bytes, aligned to `align` bytes.
+ * Returns false if such objects don't fit in a slab.
+ */
+static bool kmem_cache_init(kmem_cache_t* cache, const char* name, size_t size, size_t align) {
+    if (!align) {
+        align = 4;
+    }
+
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+
+    *cache = (kmem_cache_t) {
+        .name = name,
+        .size = align_to(size, align),
+        .offset = align_to(sizeof(slab_t), align),
+        .partial = NULL,
+        .full = NULL
+    };
+
+    if (cache->offset + cache->size > SLAB_SIZE) {
+        return false;
+    }
+
+    cache->per_slab = (SLAB_SIZE - cache->offset) / cache->size;
+
+    return true;
+}
+
+static void slab_list_add(slab_t** list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+
+    if (*list) {
+        (*list)->prev = slab;
+    }
+
+    *list = slab;
+}
+
+static void slab_list_del(slab_t** list, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* Adds a new slab to the cache, with all of its objects free.
+ */
+static slab_t* kmem_cache_grow(kmem_cache_t* cache) {
+    slab_t* slab = mem_alloc_slab_page();
+    uintptr_t objects = (uintptr_t) slab + cache->offset;
+
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->used = 0;
+
+    // Chain objects in address order
+    for (uint32_t i = cache->per_slab; i-- > 0;) {
+        void** obj = (void**) (objects + i*cache->size);
+        *obj = slab->free;
+        slab->free = obj;
+    }
+
+    slab_list_add(&cache->partial, slab);
+
+    return slab;
+}
+
+/* Creates a cache of objects of `size` bytes, aligned to `align` bytes, or to
+ * four bytes if `align` is zero. Returns NULL if those objects are too large.
+ * `name` isn't copied.
+ */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align) {
+    kmem_cache_t* cache = kmalloc(sizeof(kmem_cache_t));
+
+    if (!kmem_cache_init(cache, name, size, align)) {
+        printke("objects of cache %s are too large: %d bytes", name, size);
+        kfree(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+/* Returns an uninitialized object from the cache.
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    slab_t* slab = cache->partial ? cache->partial : kmem_cache_grow(cache);
+    void** obj = slab->free;
+
+    slab->free = *obj;
+    slab->used++;
+
+    if (!slab->free) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    return obj;
+}
+
+/* Returns an object to the cache it was allocated from.
+ * A single empty slab is kept per cache, others are given back to the heap.
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = (slab_t*) ((uintptr_t) obj & ~(SLAB_SIZE - 1));
+
+    if (slab->cache != cache) {
+        printke("object %p freed to the wrong cache: %s", obj, cache->name);
+        abort();
+    }
+
+    if (!slab->free) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void**) obj = slab->free;
+    slab->free = obj;
+    slab->used--;
+
+    if (!slab->used && (cache->partial != slab || slab->next)) {
+        slab_list_del(&cache->partial, slab);
+        mem_free_slab_page(slab);
+    }
+}
+
+/* Returns an object of at least `size` bytes aligned to `align` from the
+ * size classes, or NULL if it's too large for them.
+ * Used by `kmalloc`.
+ */
+void* slab_alloc(size_t size, size_t align) {
+    uint32_t shift = SLAB_MIN_SHIFT;
+
+    while (((size_t) 1 << shift) < size) {
+        shift++;
+    }
+
+    // Objects are aligned to their size class
+    if (shift > SLAB_MAX_SHIFT || align > ((size_t) 1 << shift)) {
+        return NULL;
+    }
+
+    if (!size_caches[0].size) {
+        for (uint32_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+            uint32_t class_size = 1 << (SLAB_MIN_SHIFT + i);
+            kmem_cache_init(&size_caches[i], size_cache_names[i], class_size, class_size);
+        }
+    }
+
+    return kmem_cache_alloc(&size_caches[shift - SLAB_MIN_SHIFT]);
+}
+
+/* Frees an object from any cache.
+ */
+void slab_free(void* obj) {
+    slab_t* slab = (slab_t*) ((uintptr_t) obj & ~(SLAB_SIZE - 1));
+
+    kmem_cache_free(slab->cache, obj);
+}
+
+/* Returns the usable size of an object from any cache.
+ */
+size_t slab_size(void* obj) {
+    slab_t* slab = (slab_t*) ((uintptr_t) obj & ~(SLAB_SIZE - 1));
+
+    return slab->cache->size;
+}
+
+#endif
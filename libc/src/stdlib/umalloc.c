@@ -0,0 +1,524 @@
+#ifndef _KERNEL_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Userspace allocator.
+ * Chunks carry their size in a header, and free chunks repeat it in a footer,
+ * so that a freed chunk can be merged with its free neighbours in O(1). Free
+ * chunks are kept in segregated lists by size, and the free chunk at the top
+ * of the heap is given back to the kernel when it grows large.
+ *
+ *   used chunk: [size|flags][payload...]
+ *   free chunk: [size|flags][next][prev][...][size]
+ */
+
+#define CHUNK_USED 1      // This chunk is in use
+#define CHUNK_PREV_USED 2 // The chunk right before this one is in use
+#define CHUNK_FLAGS (CHUNK_USED | CHUNK_PREV_USED)
+
+#define HEADER_SIZE 4
+#define CHUNK_ALIGN 8
+#define MIN_CHUNK 16
+
+/* Free lists: one per 8 bytes below 128 bytes, then one per power of two.
+ * The last one holds everything larger.
+ */
+#define NUM_BINS 32
+#define SMALL_BIN_LIMIT 128
+
+/* The top free chunk is trimmed down to `TOP_PAD` bytes when it exceeds
+ * `TRIM_THRESHOLD` bytes.
+ */
+#define TRIM_THRESHOLD 0x20000
+#define TOP_PAD 0x4000
+
+typedef struct chunk_t {
+    uint32_t size;
+    struct chunk_t* next; // Only valid in free chunks
+    struct chunk_t* prev;
+} chunk_t;
+
+typedef struct {
+    uint32_t heap_size;
+    uint32_t peak_heap_size;
+    uint32_t used_size;
+    uint32_t sbrk_calls;
+    uint32_t trimmed_size;
+    uint32_t reallocs_in_place;
+    uint32_t reallocs_moved;
+} malloc_counters_t;
+
+static chunk_t* bins[NUM_BINS];
+static uint32_t binmap = 0; // Bit `n` is set when `bins[n]` isn't empty
+static chunk_t* epilogue = NULL; // Zero-sized used chunk ending the heap
+static malloc_counters_t counters;
+
+/* Returns the next multiple of `s` greater than `a`, or `a` if it is a
+ * multiple of `s`.
+ * Copy of the same function in <kernel/sys.h>
+ */
+static uint32_t align_to(uint32_t n, uint32_t align) {
+    if (n % align == 0) {
+        return n;
+    }
+
+    return n + (align - n % align);
+}
+
+/* Moves the program break by `size` bytes, which may be negative.
+ * Returns the previous break, or -1 on failure.
+ */
+static void* sbrk(intptr_t size) {
+    uintptr_t addr;
+
+    asm volatile (
+        "mov $4, %%eax\n"
+        "mov %[size], %%ebx\n"
+        "int $0x30\n"
+        "mov %%eax, %[addr]\n"
+        : [addr] "=r" (addr)
+        : [size] "r" (size)
+        : "%eax", "%ebx"
+    );
+
+    if (size) {
+        counters.sbrk_calls++;
+    }
+
+    return (void*) addr;
+}
+
+static uint32_t chunk_size(chunk_t* chunk) {
+    return chunk->size & ~CHUNK_FLAGS;
+}
+
+static chunk_t* chunk_next(chunk_t* chunk) {
+    return (chunk_t*) ((uintptr_t) chunk + chunk_size(chunk));
+}
+
+/* Returns the chunk before `chunk`, which must be free.
+ */
+static chunk_t* chunk_prev(chunk_t* chunk) {
+    uint32_t prev_size = *((uint32_t*) chunk - 1);
+
+    return (chunk_t*) ((uintptr_t) chunk - prev_size);
+}
+
+static void chunk_set_footer(chunk_t* chunk) {
+    *((uint32_t*) chunk_next(chunk) - 1) = chunk_size(chunk);
+}
+
+static void* chunk_to_mem(chunk_t* chunk) {
+    return (uint8_t*) chunk + HEADER_SIZE;
+}
+
+static chunk_t* mem_to_chunk(void* mem) {
+    return (chunk_t*) ((uint8_t*) mem - HEADER_SIZE);
+}
+
+/* Returns the size of the chunk needed to hold `size` bytes.
+ */
+static uint32_t chunk_size_for(size_t size) {
+    uint32_t needed = align_to(size + HEADER_SIZE, CHUNK_ALIGN);
+
+    return needed < MIN_CHUNK ? MIN_CHUNK : needed;
+}
+
+static uint32_t bin_index(uint32_t size) {
+    if (size < SMALL_BIN_LIMIT) {
+        return size / CHUNK_ALIGN;
+    }
+
+    // 128 bytes and above go in bin 16, 256 in bin 17, etc.
+    uint32_t index = SMALL_BIN_LIMIT / CHUNK_ALIGN + (31 - __builtin_clz(size)) - 7;
+
+    return index < NUM_BINS ? index : NUM_BINS - 1;
+}
+
+static void bin_insert(chunk_t* chunk) {
+    uint32_t index = bin_index(chunk_size(chunk));
+
+    chunk->prev = NULL;
+    chunk->next = bins[index];
+
+    if (bins[index]) {
+        bins[index]->prev = chunk;
+    }
+
+    bins[index] = chunk;
+    binmap |= 1u << index;
+}
+
+static void bin_remove(chunk_t* chunk) {
+    uint32_t index = bin_index(chunk_size(chunk));
+
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        bins[index] = chunk->next;
+    }
+
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+
+    if (!bins[index]) {
+        binmap &= ~(1u << index);
+    }
+}
+
+/* Returns a free chunk of at least `size` bytes, removed from its list, or
+ * NULL if there's none.
+ */
+static chunk_t* bin_find(uint32_t size) {
+    uint32_t index = bin_index(size);
+
+    // Chunks in the first list may be too small if it isn't an exact one
+    if (index >= SMALL_BIN_LIMIT / CHUNK_ALIGN) {
+        for (chunk_t* chunk = bins[index]; chunk; chunk = chunk->next) {
+            if (chunk_size(chunk) >= size) {
+                bin_remove(chunk);
+                return chunk;
+            }
+        }
+
+        index++;
+    }
+
+    // Any chunk in the following lists is large enough
+    uint32_t candidates = index < NUM_BINS ? binmap & ~((1u << index) - 1) : 0;
+
+    if (!candidates) {
+        return NULL;
+    }
+
+    chunk_t* chunk = bins[__builtin_ctz(candidates)];
+    bin_remove(chunk);
+
+    return chunk;
+}
+
+/* Sets up an empty heap at the program break.
+ */
+static bool heap_init() {
+    uintptr_t brk = (uintptr_t) sbrk(0);
+
+    // Chunk headers sit just before 8-bytes aligned addresses
+    uint32_t pad = (CHUNK_ALIGN + HEADER_SIZE - brk % CHUNK_ALIGN) % CHUNK_ALIGN;
+
+    if (sbrk(pad + HEADER_SIZE) == (void*) -1) {
+        return false;
+    }
+
+    epilogue = (chunk_t*) (brk + pad);
+    epilogue->size = CHUNK_USED | CHUNK_PREV_USED;
+    counters.heap_size = pad + HEADER_SIZE;
+
+    return true;
+}
+
+/* Grows the heap so that it ends with a free chunk of at least `size` bytes,
+ * and returns that chunk, which isn't in any list. Returns NULL if the kernel
+ * refuses to give us more memory.
+ */
+static chunk_t* heap_extend(uint32_t size) {
+    uintptr_t brk = (uintptr_t) epilogue + HEADER_SIZE;
+    chunk_t* chunk = epilogue;
+    uint32_t available = 0;
+
+    // Reuse the free chunk at the top of the heap, if there's one
+    if (!(epilogue->size & CHUNK_PREV_USED)) {
+        chunk = chunk_prev(epilogue);
+        available = chunk_size(chunk);
+    }
+
+    uint32_t grow = 0;
+
+    if (size > available) {
+        grow = align_to(brk + size - available, 0x1000) - brk;
+
+        if (sbrk(grow) == (void*) -1) {
+            return NULL;
+        }
+    }
+
+    if (available) {
+        bin_remove(chunk);
+    }
+
+    chunk->size = (available + grow) | (chunk->size & CHUNK_PREV_USED);
+    chunk_set_footer(chunk);
+
+    epilogue = chunk_next(chunk);
+    epilogue->size = CHUNK_USED;
+
+    counters.heap_size += grow;
+
+    if (counters.heap_size > counters.peak_heap_size) {
+        counters.peak_heap_size = counters.heap_size;
+    }
+
+    return chunk;
+}
+
+/* Gives the end of `top`, a free chunk at the end of the heap, back to the
+ * kernel.
+ */
+static void heap_trim(chunk_t* top) {
+    uintptr_t brk = (uintptr_t) epilogue + HEADER_SIZE;
+    uintptr_t new_brk = align_to((uintptr_t) top + MIN_CHUNK + TOP_PAD, 0x1000);
+
+    if (new_brk >= brk || sbrk(new_brk - brk) == (void*) -1) {
+        return;
+    }
+
+    top->size = (new_brk - HEADER_SIZE - (uintptr_t) top) | CHUNK_PREV_USED;
+    chunk_set_footer(top);
+
+    epilogue = chunk_next(top);
+    epilogue->size = CHUNK_USED;
+
+    counters.heap_size -= brk - new_brk;
+    counters.trimmed_size += brk - new_brk;
+}
+
+/* Marks a chunk as free, merging it with its free neighbours.
+ */
+static void chunk_release(chunk_t* chunk) {
+    uint32_t size = chunk_size(chunk);
+    chunk_t* next = chunk_next(chunk);
+
+    if (!(chunk->size & CHUNK_PREV_USED)) {
+        chunk = chunk_prev(chunk);
+        bin_remove(chunk);
+        size += chunk_size(chunk);
+    }
+
+    if (!(next->size & CHUNK_USED)) {
+        bin_remove(next);
+        size += chunk_size(next);
+    }
+
+    // Two free chunks are never adjacent, so the previous one is used
+    chunk->size = size | CHUNK_PREV_USED;
+    chunk_set_footer(chunk);
+
+    next = chunk_next(chunk);
+    next->size &= ~CHUNK_PREV_USED;
+
+    if (next == epilogue && size >= TRIM_THRESHOLD) {
+        heap_trim(chunk);
+    }
+
+    bin_insert(chunk);
+}
+
+/* Marks a free chunk as used.
+ */
+static void chunk_use(chunk_t* chunk) {
+    chunk->size |= CHUNK_USED;
+    chunk_next(chunk)->size |= CHUNK_PREV_USED;
+    counters.used_size += chunk_size(chunk);
+}
+
+/* Shrinks a used chunk to `size` bytes, freeing what's left if it's large
+ * enough to make a chunk.
+ */
+static void chunk_split(chunk_t* chunk, uint32_t size) {
+    uint32_t remaining = chunk_size(chunk) - size;
+
+    if (remaining < MIN_CHUNK) {
+        return;
+    }
+
+    chunk->size = size | (chunk->size & CHUNK_FLAGS);
+
+    chunk_t* rest = chunk_next(chunk);
+    rest->size = remaining | CHUNK_USED | CHUNK_PREV_USED;
+
+    counters.used_size -= remaining;
+    chunk_release(rest);
+}
+
+/* Returns a pointer to a memory area of at least `size` bytes.
+ */
+void* malloc(size_t size) {
+    if (size > 0x7FFFFFFF) {
+        return NULL;
+    }
+
+    if (!epilogue && !heap_init()) {
+        return NULL;
+    }
+
+    uint32_t needed = chunk_size_for(size);
+    chunk_t* chunk = bin_find(needed);
+
+    if (!chunk) {
+        chunk = heap_extend(needed);
+
+        if (!chunk) {
+            printf("[mem] Allocation failure\n");
+            return NULL;
+        }
+    }
+
+    chunk_use(chunk);
+    chunk_split(chunk, needed);
+
+    return chunk_to_mem(chunk);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    void* ptr = malloc(nmemb * size);
+
+    if (!ptr) {
+        return NULL;
+    }
+
+    return memset(ptr, 0, nmemb * size);
+}
+
+void* zalloc(size_t size) {
+    return calloc(1, size);
+}
+
+/* Resizes the allocation at `ptr`, in place when the memory right after it is
+ * free or when it sits at the top of the heap.
+ */
+void* realloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (size > 0x7FFFFFFF) {
+        return NULL;
+    }
+
+    chunk_t* chunk = mem_to_chunk(ptr);
+    chunk_t* next = chunk_next(chunk);
+    uint32_t needed = chunk_size_for(size);
+    uint32_t old_size = chunk_size(chunk);
+    bool next_free = !(next->size & CHUNK_USED);
+
+    if (needed > old_size) {
+        uint32_t grown_size = 0;
+
+        if (next == epilogue || (next_free && chunk_next(next) == epilogue)) {
+            // Grow the heap under our feet
+            chunk_t* top = heap_extend(needed - old_size);
+
+            if (top) {
+                grown_size = chunk_size(top);
+            }
+        } else if (next_free && old_size + chunk_size(next) >= needed) {
+            bin_remove(next);
+            grown_size = chunk_size(next);
+        }
+
+        if (!grown_size) {
+            void* new = malloc(size);
+
+            if (!new) {
+                return NULL;
+            }
+
+            memcpy(new, ptr, old_size - HEADER_SIZE);
+            free(ptr);
+            counters.reallocs_moved++;
+
+            return new;
+        }
+
+        chunk->size += grown_size;
+        chunk_next(chunk)->size |= CHUNK_PREV_USED;
+        counters.used_size += grown_size;
+        counters.reallocs_in_place++;
+    }
+
+    chunk_split(chunk, needed);
+
+    return ptr;
+}
+
+/* Frees a pointer previously returned by `malloc`.
+ */
+void free(void* pointer) {
+    if (!pointer) {
+        return;
+    }
+
+    chunk_t* chunk = mem_to_chunk(pointer);
+
+    counters.used_size -= chunk_size(chunk);
+    chunk_release(chunk);
+}
+
+/* Returns `size` bytes of memory at an address multiple of `align`, which
+ * must be a power of two.
+ */
+void* aligned_alloc(size_t align, size_t size) {
+    if (align <= CHUNK_ALIGN) {
+        return malloc(size);
+    }
+
+    uint8_t* mem = malloc(chunk_size_for(size) + align + MIN_CHUNK);
+
+    if (!mem || (uintptr_t) mem % align == 0) {
+        return mem;
+    }
+
+    // Free the beginning of the chunk, it must be large enough to be a chunk
+    chunk_t* chunk = mem_to_chunk(mem);
+    uintptr_t aligned = align_to((uintptr_t) mem + MIN_CHUNK, align);
+    uint32_t lead_size = aligned - (uintptr_t) mem;
+
+    chunk_t* aligned_chunk = mem_to_chunk((void*) aligned);
+    aligned_chunk->size = (chunk_size(chunk) - lead_size) | CHUNK_USED | CHUNK_PREV_USED;
+    chunk->size = lead_size | (chunk->size & CHUNK_FLAGS);
+
+    counters.used_size -= lead_size;
+    chunk_release(chunk);
+    chunk_split(aligned_chunk, chunk_size_for(size));
+
+    return (void*) aligned;
+}
+
+/* Prints statistics about this process' heap.
+ */
+void malloc_stats() {
+    uint32_t free_chunks = 0;
+    uint32_t free_size = 0;
+    uint32_t largest_free = 0;
+
+    for (uint32_t i = 0; i < NUM_BINS; i++) {
+        for (chunk_t* chunk = bins[i]; chunk; chunk = chunk->next) {
+            uint32_t size = chunk_size(chunk);
+
+            free_chunks++;
+            free_size += size;
+
+            if (size > largest_free) {
+                largest_free = size;
+            }
+        }
+    }
+
+    printf("heap: %u bytes, peak %u bytes, %u bytes trimmed in %u sbrk calls\n",
+        counters.heap_size, counters.peak_heap_size, counters.trimmed_size,
+        counters.sbrk_calls);
+    printf("used: %u bytes, free: %u bytes in %u chunks, largest %u bytes\n",
+        counters.used_size, free_size, free_chunks, largest_free);
+    printf("realloc: %u in place, %u moved\n",
+        counters.reallocs_in_place, counters.reallocs_moved);
+}
+
+#endif
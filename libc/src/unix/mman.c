@@ -0,0 +1,31 @@
+#ifndef _KERNEL_
+
+#include <sys/mman.h>
+
+#include <kernel/uapi/uapi_syscall.h>
+
+extern int32_t syscall1(uint32_t eax, uint32_t ebx);
+extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
+
+/* Maps `length` bytes of the file open as `fd`, from `offset`. The kernel
+ * chooses where: `addr` is ignored.
+ */
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, uint32_t offset) {
+    (void) addr;
+
+    sys_mmap_t args = {
+        .length = length,
+        .prot = prot,
+        .flags = flags,
+        .fd = fd,
+        .offset = offset
+    };
+
+    return (void*) syscall1(SYS_MMAP, (uintptr_t) &args);
+}
+
+int munmap(void* addr, size_t length) {
+    return syscall2(SYS_MUNMAP, (uintptr_t) addr, length);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _KERNEL_
+
+#include <unistd.h>
+
+#include <kernel/uapi/uapi_syscall.h>
+
+extern int32_t syscall(uint32_t eax);
+extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
+
+int fork() {
+    return syscall(SYS_FORK);
+}
+
+/* Only returns on failure.
+ */
+int execv(const char* path, char* const argv[]) {
+    return syscall2(SYS_EXECVE, (uintptr_t) path, (uintptr_t) argv);
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <kernel/uapi/uapi_syscall.h>
 #include <kernel/uapi/uapi_fs.h>
 
+extern int32_t syscall(uint32_t eax);
 extern int32_t syscall1(uint32_t eax, uint32_t ebx);
 extern int32_t syscall2(uint32_t eax, uint32_t ebx, uint32_t ecx);
 
@@ -31,6 +32,12 @@ int unlink(const char* path) {
     return syscall1(SYS_UNLINK, (uintptr_t) path);
 }
 
+/* Writes back the filesystem metadata the kernel keeps in memory.
+ */
+void sync() {
+    syscall(SYS_SYNC);
+}
+
 int stat(const char* path, struct stat* buf) {
     stat_t statbuf;
     int ret = syscall2(SYS_STAT, (uintptr_t) path, (uintptr_t) &statbuf);
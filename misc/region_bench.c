@@ -0,0 +1,328 @@
+/* Hosted microbenchmark of the window manager's region code.
+ *
+ * `region.c` only depends on the kernel's allocators, so it's built here for
+ * the host against a stub `kmalloc` and `kmem_cache`. A scripted session of
+ * window operations (opening windows, dragging one around, raising, partial
+ * redraws and closing) is replayed through the same region calls the WM
+ * makes, and the time spent per operation is reported. Nothing is drawn:
+ * draws only walk the clipped rects.
+ *
+ * Build and run it from the repository's root with:
+ *     make region-bench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Stand-ins for the kernel's allocators and libc's helpers */
+
+typedef struct kmem_cache_t {
+    size_t size;
+} kmem_cache_t;
+
+static kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align) {
+    kmem_cache_t* cache = malloc(sizeof(kmem_cache_t));
+
+    (void) name;
+    (void) align;
+    cache->size = size;
+
+    return cache;
+}
+
+static void* kmem_cache_alloc(kmem_cache_t* cache) {
+    return malloc(cache->size);
+}
+
+static void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    (void) cache;
+    free(obj);
+}
+
+#define kmalloc malloc
+#define kfree free
+
+static inline int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+static inline int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+#include "../kernel/src/misc/wm/region.c"
+#include "../kernel/src/misc/wm/rect.c"
+
+#define SCREEN_WIDTH 1024
+#define SCREEN_HEIGHT 768
+#define MAX_WINDOWS 16
+#define ROUNDS 200
+
+typedef enum op_type_t {
+    OP_OPEN,   // Open a window of size (a, b)
+    OP_CLOSE,  // Close window `win`
+    OP_RAISE,  // Put window `win` in front
+    OP_MOVE,   // Move window `win` by (a, b), `steps` times
+    OP_DRAW,   // Redraw window `win` at (a, b), `steps` lines of 16 pixels
+} op_type_t;
+
+typedef struct op_t {
+    op_type_t type;
+    uint32_t win;
+    int32_t a;
+    int32_t b;
+    uint32_t steps;
+} op_t;
+
+/* A synthetic session, written to look like interactive use: a few windows
+ * get opened in cascade, one is dragged around under and over the others,
+ * terminals print lines, and windows get closed.
+ */
+static const op_t script[] = {
+    { OP_OPEN, 0, 640, 480, 1 },
+    { OP_OPEN, 1, 400, 300, 1 },
+    { OP_OPEN, 2, 480, 360, 1 },
+    { OP_OPEN, 3, 320, 240, 1 },
+    { OP_OPEN, 4, 500, 400, 1 },
+    { OP_OPEN, 5, 240, 180, 1 },
+    { OP_OPEN, 6, 600, 200, 1 },
+    { OP_OPEN, 7, 300, 500, 1 },
+    { OP_OPEN, 8, 200, 200, 1 },
+    { OP_OPEN, 9, 420, 260, 1 },
+    { OP_DRAW, 3, 4, 20, 12 },
+    { OP_DRAW, 1, 4, 20, 8 },
+    { OP_MOVE, 9, 5, 3, 60 },
+    { OP_MOVE, 9, -4, 2, 60 },
+    { OP_RAISE, 2, 0, 0, 1 },
+    { OP_DRAW, 2, 0, 0, 22 },
+    { OP_MOVE, 2, 6, -2, 40 },
+    { OP_DRAW, 0, 4, 20, 25 },
+    { OP_RAISE, 0, 0, 0, 1 },
+    { OP_MOVE, 0, -3, 4, 50 },
+    { OP_DRAW, 5, 4, 20, 10 },
+    { OP_DRAW, 7, 4, 20, 30 },
+    { OP_CLOSE, 8, 0, 0, 1 },
+    { OP_CLOSE, 4, 0, 0, 1 },
+    { OP_MOVE, 7, 7, 1, 30 },
+    { OP_CLOSE, 9, 0, 0, 1 },
+    { OP_CLOSE, 2, 0, 0, 1 },
+    { OP_CLOSE, 6, 0, 0, 1 },
+    { OP_CLOSE, 0, 0, 0, 1 },
+    { OP_CLOSE, 7, 0, 0, 1 },
+    { OP_CLOSE, 3, 0, 0, 1 },
+    { OP_CLOSE, 1, 0, 0, 1 },
+    { OP_CLOSE, 5, 0, 0, 1 },
+};
+
+#define SCRIPT_LENGTH (sizeof(script)/sizeof(script[0]))
+
+static wm_window_t windows[MAX_WINDOWS];
+static wm_window_t* stack[MAX_WINDOWS]; // From the bottom window up
+static uint32_t num_windows = 0;
+static region_t desktop;
+static uint64_t drawn = 0; // Pixels that would have been drawn
+
+/* Same as `wm_update_visible`.
+ */
+static void update_visible() {
+    rect_t screen_rect = {
+        .top = 0, .left = 0, .bottom = SCREEN_HEIGHT - 1, .right = SCREEN_WIDTH - 1
+    };
+
+    region_fini(&desktop);
+    region_init_rect(&desktop, screen_rect);
+
+    for (int32_t i = num_windows - 1; i >= 0; i--) {
+        rect_t rect = rect_from_window(stack[i]);
+
+        region_copy(&stack[i]->visible, &desktop);
+        region_intersect_rect(&stack[i]->visible, rect);
+        region_subtract_rect(&desktop, rect);
+    }
+}
+
+/* Same clipping as `wm_draw_window`.
+ */
+static void draw_window(wm_window_t* win, rect_t clip) {
+    rect_t* visible = win->visible.rects;
+
+    for (uint32_t i = 0; i < win->visible.count && visible[i].top <= clip.bottom; i++) {
+        if (rect_intersect(visible[i], clip)) {
+            rect_t r = rect_clip(visible[i], clip);
+            drawn += (r.bottom - r.top + 1)*(r.right - r.left + 1);
+        }
+    }
+}
+
+/* Same as `wm_refresh_partial`.
+ */
+static void refresh_partial(rect_t clip) {
+    for (uint32_t i = 0; i < num_windows; i++) {
+        if (rect_intersect(rect_from_window(stack[i]), clip)) {
+            draw_window(stack[i], clip);
+        }
+    }
+
+    for (uint32_t i = 0; i < desktop.count; i++) {
+        if (rect_intersect(desktop.rects[i], clip)) {
+            rect_t r = rect_clip(desktop.rects[i], clip);
+            drawn += (r.bottom - r.top + 1)*(r.right - r.left + 1);
+        }
+    }
+}
+
+/* Same region operations as `wm_move_window`.
+ */
+static void move_window(wm_window_t* win, int32_t dx, int32_t dy) {
+    region_t old;
+    region_t moved;
+    region_t exposed;
+
+    region_init(&old);
+    region_init(&moved);
+    region_init(&exposed);
+    region_copy(&old, &win->visible);
+
+    win->x += dx;
+    win->y += dy;
+    update_visible();
+
+    region_copy(&moved, &old);
+    region_translate(&moved, dx, dy);
+    region_intersect(&moved, &moved, &win->visible);
+
+    region_subtract(&exposed, &win->visible, &moved);
+
+    for (uint32_t i = 0; i < exposed.count; i++) {
+        draw_window(win, exposed.rects[i]);
+    }
+
+    region_subtract(&exposed, &old, &win->visible);
+
+    for (uint32_t i = 0; i < exposed.count; i++) {
+        refresh_partial(exposed.rects[i]);
+    }
+
+    region_fini(&old);
+    region_fini(&moved);
+    region_fini(&exposed);
+}
+
+/* Returns the position of `win` in the stack.
+ */
+static uint32_t stack_index(wm_window_t* win) {
+    uint32_t i = 0;
+
+    while (stack[i] != win) {
+        i++;
+    }
+
+    return i;
+}
+
+/* Runs an operation of the script, returns the number of WM calls it made.
+ */
+static uint32_t run(const op_t* op) {
+    wm_window_t* win = &windows[op->win];
+    rect_t rect = rect_from_window(win);
+
+    switch (op->type) {
+    case OP_OPEN:
+        // Cascade windows like `wm_assign_position` does
+        *win = (wm_window_t) {
+            .x = 20 + 40*num_windows,
+            .y = 20 + 30*num_windows
+        };
+
+        win->kfb.width = op->a;
+        win->kfb.height = op->b;
+        region_init(&win->visible);
+        stack[num_windows++] = win;
+        update_visible();
+        draw_window(win, rect_from_window(win));
+        break;
+    case OP_CLOSE: {
+        uint32_t i = stack_index(win);
+
+        memmove(&stack[i], &stack[i + 1], (num_windows - i - 1)*sizeof(wm_window_t*));
+        num_windows--;
+        region_fini(&win->visible);
+        update_visible();
+        refresh_partial(rect);
+        break;
+    }
+    case OP_RAISE: {
+        uint32_t i = stack_index(win);
+
+        memmove(&stack[i], &stack[i + 1], (num_windows - i - 1)*sizeof(wm_window_t*));
+        stack[num_windows - 1] = win;
+        update_visible();
+        draw_window(win, rect);
+        break;
+    }
+    case OP_MOVE:
+        for (uint32_t i = 0; i < op->steps; i++) {
+            move_window(win, op->a, op->b);
+        }
+
+        break;
+    case OP_DRAW:
+        for (uint32_t i = 0; i < op->steps; i++) {
+            rect_t line = {
+                .top = rect.top + op->b + 16*i, .left = rect.left + op->a,
+                .bottom = rect.top + op->b + 16*i + 15, .right = rect.right - op->a
+            };
+
+            draw_window(win, line);
+        }
+
+        break;
+    }
+
+    return op->steps;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+int main() {
+    uint64_t total = 0;
+    uint64_t best = (uint64_t) -1;
+    uint32_t calls = 0;
+
+    region_init(&desktop);
+
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+        uint64_t before = now_ns();
+        calls = 0;
+
+        for (uint32_t i = 0; i < SCRIPT_LENGTH; i++) {
+            calls += run(&script[i]);
+        }
+
+        uint64_t time = now_ns() - before;
+        total += time;
+
+        if (time < best) {
+            best = time;
+        }
+    }
+
+    printf("%u WM calls per round, %llu pixels clipped\n",
+        calls, (unsigned long long) drawn/ROUNDS);
+    printf("ns per call: min %llu, average %llu\n",
+        (unsigned long long) best/calls, (unsigned long long) total/ROUNDS/calls);
+
+    region_fini(&desktop);
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 int main() {
     fb_t scr;
@@ -14,11 +15,15 @@ int main() {
     FILE* wp = fopen("/wallpaper.rgb", "r");
 
     if (wp) {
-        uint32_t n_pixels = win->fb.width*win->fb.height;
-        uint8_t* bg = malloc(n_pixels * 3);
-        fread(bg, 3, n_pixels, wp);
-        snow_draw_rgb(win->fb, bg, 0, 0, win->fb.width, win->fb.height);
-        free(bg);
+        // The wallpaper is drawn straight from the page cache
+        uint32_t size = win->fb.width*win->fb.height*3;
+        uint8_t* bg = mmap(NULL, size, PROT_READ, MAP_SHARED, wp->fd, 0);
+
+        if (bg != MAP_FAILED) {
+            snow_draw_rgb(win->fb, bg, 0, 0, win->fb.width, win->fb.height);
+            munmap(bg, size);
+        }
+
         fclose(wp);
     } else {
         snow_draw_rect(win->fb, 0, 0, scr.width, scr.height, 0x9AC4F8);
@@ -0,0 +1,39 @@
+#include <snow.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Measures the bandwidth of window rendering, i.e. of copying a window's
+ * buffer to the kernel and blitting it to the framebuffer.
+ */
+
+#define WIDTH 640
+#define HEIGHT 480
+#define ITERATIONS 200
+
+int main() {
+    window_t* win = snow_open_window("Blit benchmark", WIDTH, HEIGHT, WM_NORMAL);
+
+    snow_draw_window(win);
+    snow_draw_string(win->fb, "Blitting...", 20, 40, 0x00AA1100);
+    snow_render_window(win);
+
+    float start = snow_uptime();
+
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        snow_render_window(win);
+    }
+
+    float elapsed = snow_uptime() - start;
+    uint32_t bytes = WIDTH*HEIGHT*win->fb.bpp/8;
+
+    if (elapsed > 0) {
+        uint32_t mib_per_s = (uint32_t) (ITERATIONS*(bytes/1048576.0f)/elapsed);
+        printf("%d blits of %d KiB in %d ms: %d MiB/s\n", ITERATIONS, bytes >> 10,
+            (int) (elapsed*1000), mib_per_s);
+    }
+
+    snow_close_window(win);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <snow.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Measures the cost of a round trip between two processes yielding to each
+ * other, which is dominated by context switches and the TLB refills that
+ * follow them.
+ * Note: other processes may be scheduled in between; the minimum is the most
+ * meaningful figure.
+ */
+
+#define ITERATIONS_LOG2 12
+#define ITERATIONS (1 << ITERATIONS_LOG2)
+
+int main() {
+    int pid = fork();
+
+    if (pid < 0) {
+        printf("fork failed\n");
+        return 1;
+    }
+
+    // The child only gives its time slice back
+    if (pid == 0) {
+        for (uint32_t i = 0; i < ITERATIONS; i++) {
+            syscall(SYS_YIELD);
+        }
+
+        return 0;
+    }
+
+    uint64_t total = 0;
+    uint64_t best = (uint64_t) -1;
+    float start = snow_uptime();
+
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        uint64_t before = snow_rdtsc();
+        syscall(SYS_YIELD);
+        uint64_t cycles = snow_rdtsc() - before;
+
+        total += cycles;
+
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+
+    float elapsed = snow_uptime() - start;
+
+    printf("%d round trips in %d ms\n", ITERATIONS, (int) (elapsed*1000));
+    printf("cycles per round trip: min %llu, average %llu\n",
+        best, total >> ITERATIONS_LOG2);
+
+    return 0;
+}
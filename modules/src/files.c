@@ -50,7 +50,6 @@ void fv_refresh(folder_view_t* fv) {
         }
 
         vbox_add(fv->vbox, W(btn));
-        free(dent);
     }
 
     if (d) {
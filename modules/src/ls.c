@@ -30,8 +30,9 @@ int main(int argc, char* argv[]) {
 
     while ((dent = readdir(d))) {
         printf("%s%s\n", dent->d_name, dent->d_type == 2 ? "/" : "");
-        free(dent);
     }
 
+    closedir(d);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <snow.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Measures the cost of a path lookup through `stat`, for paths exercising
+ * the different steps of path normalization. Run it on two kernels to
+ * compare them.
+ */
+
+#define ITERATIONS 2000
+
+static const char* paths[] = {
+    "/terminal",
+    "terminal",
+    "./terminal",
+    "//terminal//",
+    "/../../terminal",
+    "/missing",
+};
+
+int main() {
+    struct stat buf;
+
+    for (uint32_t i = 0; i < sizeof(paths)/sizeof(paths[0]); i++) {
+        uint64_t best = (uint64_t) -1;
+
+        for (uint32_t j = 0; j < ITERATIONS; j++) {
+            uint64_t before = snow_rdtsc();
+            stat(paths[i], &buf);
+            uint64_t cycles = snow_rdtsc() - before;
+
+            if (cycles < best) {
+                best = cycles;
+            }
+        }
+
+        printf("%-20s %llu cycles\n", paths[i], best);
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <snow.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Measures the throughput of sequential file reads, on a multi-megabyte file
+ * written for the occasion.
+ */
+
+#define PATH "/read_bench.tmp"
+#define FILE_SIZE (2*1024*1024)
+#define CHUNK_SIZE (64*1024)
+#define ITERATIONS 16
+
+int main() {
+    uint8_t* buf = malloc(CHUNK_SIZE);
+    FILE* f = fopen(PATH, "w");
+
+    if (!buf || !f) {
+        printf("read_bench: failed to create '%s'\n", PATH);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < CHUNK_SIZE; i++) {
+        buf[i] = i;
+    }
+
+    for (uint32_t written = 0; written < FILE_SIZE; written += CHUNK_SIZE) {
+        fwrite(buf, 1, CHUNK_SIZE, f);
+    }
+
+    fclose(f);
+
+    sys_info_t before;
+    syscall2(SYS_INFO, SYS_INFO_CACHE, (uintptr_t) &before);
+
+    float start = snow_uptime();
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        f = fopen(PATH, "r");
+        int read;
+
+        while ((read = fread(buf, 1, CHUNK_SIZE, f)) > 0) {
+            total += read;
+        }
+
+        fclose(f);
+    }
+
+    float elapsed = snow_uptime() - start;
+
+    sys_info_t after;
+    syscall2(SYS_INFO, SYS_INFO_CACHE, (uintptr_t) &after);
+
+    if (elapsed > 0) {
+        uint32_t mib_per_s = (uint32_t) (total/1048576.0f/elapsed);
+        printf("read %d MiB in %d ms: %d MiB/s\n", total >> 20,
+            (int) (elapsed*1000), mib_per_s);
+    }
+
+    printf("page cache: %d hits, %d misses\n",
+        after.page_cache_hits - before.page_cache_hits,
+        after.page_cache_misses - before.page_cache_misses);
+
+    remove(PATH);
+    free(buf);
+
+    return 0;
+}
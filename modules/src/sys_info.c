@@ -21,6 +21,7 @@ int main() {
     char heap_usage[BUF_SIZE];
     char mem_usage[BUF_SIZE];
     char mem_total[BUF_SIZE];
+    char cache_hits[BUF_SIZE];
 
     while (true) {
         wm_event_t evt = snow_get_event(win);
@@ -34,16 +35,18 @@ int main() {
         }
 
         sys_info_t info;
-        syscall2(SYS_INFO, SYS_INFO_MEMORY, (uintptr_t) &info);
+        syscall2(SYS_INFO, SYS_INFO_MEMORY | SYS_INFO_CACHE, (uintptr_t) &info);
 
         set_str("Kernel heap used: ", "KiB", info.kernel_heap_usage >> 10, heap_usage);
         set_str("Ram used: ", "KiB", info.ram_usage >> 10, mem_usage);
         set_str("Ram total: ", "MiB", info.ram_total >> 20, mem_total);
+        set_str("Page cache hits: ", "", info.page_cache_hits, cache_hits);
 
         snow_draw_window(win); // Draws the title bar and borders
         snow_draw_string(win->fb, heap_usage, 4, 24, 0x00AA1100);
         snow_draw_string(win->fb, mem_usage, 4, 40, 0x00AA1100);
         snow_draw_string(win->fb, mem_total, 4, 56, 0x00AA1100);
+        snow_draw_string(win->fb, cache_hits, 4, 72, 0x00AA1100);
 
         snow_render_window(win);
         snow_sleep(300);
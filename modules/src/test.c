@@ -52,8 +52,6 @@ void tree(char* path, int level) {
             tree(p, level + 1);
             p[strlen(p) - nl - 1] = 0;
         }
-
-        free(e);
     }
 
     closedir(d);
@@ -24,10 +24,20 @@ typedef struct {
     fb_t fb;
     uint32_t id;
     uint32_t flags;
+    bool shared; // Whether `fb` is shared with the window manager
 } window_t;
 
 void snow_get_fb_info(fb_t* fb);
 void snow_sleep(uint32_t ms);
+float snow_uptime();
+
+// Reads the CPU's timestamp counter, inline so that timing a few cycles works
+static inline uint64_t snow_rdtsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return ((uint64_t) high << 32) | low;
+}
 
 // Drawing functions
 void snow_draw_pixel(fb_t fb, int x, int y, uint32_t col);
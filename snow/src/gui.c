@@ -13,6 +13,8 @@ uint32_t snow_wm_open_window(fb_t* fb, uint32_t flags) {
 }
 
 /* Returns a window object that can be used to draw things in.
+ * Its buffer is shared with the window manager when possible, so that it's
+ * rendered without being copied.
  */
 window_t* snow_open_window(const char* title, int width, int height, uint32_t flags) {
     window_t* win = (window_t*) malloc(sizeof(window_t));
@@ -22,7 +24,7 @@ window_t* snow_open_window(const char* title, int width, int height, uint32_t fl
     win->width = width;
     win->height = height;
     win->fb = (fb_t) {
-        .address = (uintptr_t) zalloc(width*height*bpp/8),
+        .address = 0,
         .pitch = width*bpp/8,
         .width = width,
         .height = height,
@@ -30,6 +32,13 @@ window_t* snow_open_window(const char* title, int width, int height, uint32_t fl
     };
 
     win->id = snow_wm_open_window(&win->fb, flags);
+    win->shared = win->id != 0;
+
+    if (!win->shared) {
+        win->fb.address = (uintptr_t) zalloc(width*height*bpp/8);
+        win->id = snow_wm_open_window(&win->fb, flags);
+    }
+
     win->flags = flags;
 
     return win;
@@ -39,7 +48,12 @@ void snow_close_window(window_t* win) {
     syscall2(SYS_WM, WM_CMD_CLOSE, win->id);
 
     free(win->title);
-    free((void*) win->fb.address);
+
+    // The window manager unmaps shared buffers itself
+    if (!win->shared) {
+        free((void*) win->fb.address);
+    }
+
     free(win);
 }
 
@@ -9,4 +9,13 @@ void snow_get_fb_info(fb_t* fb) {
 
 void snow_sleep(uint32_t ms) {
     syscall1(SYS_SLEEP, ms);
+}
+
+/* Returns the time elapsed since boot, in seconds.
+ */
+float snow_uptime() {
+    sys_info_t info;
+    syscall2(SYS_INFO, SYS_INFO_UPTIME, (uintptr_t) &info);
+
+    return info.uptime;
 }
\ No newline at end of file